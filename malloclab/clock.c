@@ -141,3 +141,16 @@ double get_counter()
     return delta_secs * cpu_mhz * 1e6;
 }
 
+uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    asm volatile("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    /* no TSC: nanoseconds instead */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
@@ -1,4 +1,5 @@
 /* Routines for timing functions */
+#include <stdint.h>
 
 /*  minimum resolution of timer (secs) */
 extern const double timer_resolution;
@@ -20,3 +21,7 @@ void start_counter();
 
 /* Get # cycles since counter started.  Returns 1e20 if detect timing anomaly */
 double get_counter();
+
+/* Read the time stamp counter, which ticks at the nominal clock rate.
+   Fenced, so that it times just the code between two reads. */
+uint64_t read_tsc();
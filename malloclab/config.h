@@ -152,9 +152,9 @@
 #define SPARSE_PAGE_SIZE (1<<10)
 
 /*
- * Maximum target load for hash table
+ * Maximum load of the open-addressed page table: pages per slot
  */
-#define HASH_LOAD 10.0
+#define HASH_LOAD 0.5
 
 /***************** Parameters for looking up reference throughput *********/
 /*
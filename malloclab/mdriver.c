@@ -7,6 +7,7 @@
  * Copyright (c) 2004-2016, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
@@ -20,12 +21,18 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
+#include "clock.h"
 #include "config.h"
 #include "stree.h"
+#include "mtrace.h"
+#include "perfctr.h"
 
 /**********************
  * Constants and macros
@@ -40,6 +47,28 @@
 #define REF_ONLY 0
 #endif
 
+/* Set by mdriver-mt, whose mm.c is built thread-safe; enables -m */
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+
+#if MM_THREADS
+#define MT_OPTS "m:"
+#define MT_HANDOFF 4   /* every MT_HANDOFF'th free is done by another thread */
+#define MT_RUNS    3   /* time each thread count this many times, keep best */
+#else
+#define MT_OPTS ""
+#endif
+
+/* Latency mode (-L): request types, and how many of the slowest
+   requests of each trace are kept */
+#define NUM_TYPES   (FREE_BATCH + 1)
+#define NUM_SLOWEST 8
+
+/* Heap profiles (-H) */
+#define PROFILE_ROWS  512   /* snapshots per trace, at most (plus the last) */
+#define PROFILE_WIDTH 512   /* cells across each row of the heap map */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -78,13 +107,6 @@ typedef struct {
     tree_t *lo_tree;
 } range_set_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    long index;                         /* index for free() to use later */
-    size_t size;                        /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file */
 typedef struct {
     char filename[MAXLINE];
@@ -93,9 +115,14 @@ typedef struct {
     int num_ops;          /* number of distinct requests */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
+    size_t ops_length;    /* length mapped for a binary trace, else 0 */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
+    int num_arenas;       /* number of user arena ids */
+    mm_arena_t **arenas;  /* user arenas created by the trace, ... */
+    int *arena_first;     /* ... the last block allocated from each, or -1, */
+    int *arena_next;      /* ... and per block, the one allocated before it */
 } trace_t;
 
 /*
@@ -108,6 +135,20 @@ typedef struct {
     range_set_t *ranges;
 } speed_t;
 
+/* Latency percentiles of one request type on one trace, in TSC cycles */
+typedef struct {
+    int count;          /* number of requests of this type */
+    uint64_t p50, p99, p999, max;
+} latency_t;
+
+/* One of the slowest requests of a trace */
+typedef struct {
+    int op;             /* request number in the trace */
+    int type;
+    size_t size;
+    uint64_t cycles;
+} slow_op_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -122,10 +163,27 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    size_t peak_heap;  /* largest heap size during the utilization run */
+    size_t resident;   /* heap bytes still resident at the end of that run */
+    latency_t latency[NUM_TYPES]; /* -L: per request type ... */
+    slow_op_t slowest[NUM_SLOWEST]; /* ... and the slowest requests */
+    int num_slowest;
+    double perfctr[NUM_PERFCTRS]; /* -P: events in one more timed replay */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* The heap profile of one trace being written, for -H */
+typedef struct {
+    FILE *csv;             /* the time series, one snapshot per line */
+    int interval;          /* requests between snapshots */
+    int rows;              /* snapshots taken */
+    unsigned char *map;    /* PROFILE_WIDTH cells per snapshot ... */
+    size_t *heap_size;     /* ... spread over this many heap bytes */
+    int csv_lists;         /* list columns in the time series, or -1 */
+    char name[MAXLINE];    /* the files, less their extension */
+} profile_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -161,6 +219,12 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool memory_mode = false;  /* Report peak vs. final resident memory */
+static bool latency_mode = false; /* Report per-request latency percentiles */
+static bool perfctr_mode = false; /* Report hardware performance counters */
+static int mt_threads = 0;        /* -m: replay on up to this many threads */
+static int jobs = 1;              /* -j: evaluate this many traces at once */
+static char *profile_dir = NULL;  /* -H: write heap profiles here */
 /* If set, use sparse memory emulation */
 static bool sparse_mode = SPARSE_MODE;
 static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
@@ -223,6 +287,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
+static void arena_add(trace_t *trace, int arena, int index);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static bool eval_libc_valid(trace_t *trace);
@@ -231,11 +296,24 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void profile_open(profile_t *profile, const trace_t *trace);
+static void profile_snapshot(profile_t *profile, int op, size_t live);
+static void profile_close(profile_t *profile);
+
+#if MM_THREADS
+/* Replays a trace on several threads at once and reports the scaling */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int max_threads);
+#endif
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printmemory(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printperfctr(int n, stats_t *stats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -258,6 +336,77 @@ static void timeout_handler(int sig __attribute__((unused))) {
 static double lookup_ref_throughput(bool checkpoint);
 static double measure_ref_throughput(bool checkpoint);
 
+/*
+ * run_trace - check, measure and time one trace on the mm package, in a
+ *     heap of its own, and fill in its stats.  Returns false if this was
+ *     the only run wanted (-c).
+ */
+static bool run_trace(int i, const char *tracedir, const char *tracefile,
+                      stats_t *stats, speed_t *speed_params) {
+    /* initialize simulated memory system in memlib.c *
+     * start each trace with a clean system */
+    mem_init(sparse_mode);
+    range_set_t *ranges = new_range_set();
+
+
+    // NOTE: If times out, then it will reread the trace file
+
+    trace_t *trace;
+    trace = read_trace(stats, tracedir, tracefile);
+    strcpy(stats->filename, trace->filename);
+    stats->ops = trace->num_ops;
+
+    /* Prepare for timeout */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        stats->valid = false;
+    } else {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        stats->valid =
+            /* Do 2 tests, since may fail to reinitialize properly */
+            eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+
+        if (onetime_flag) {
+            free_trace(trace);
+            free_range_set(ranges);
+            return false;
+        }
+    }
+    if (stats->valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        stats->util = eval_mm_util(trace, i, stats);
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        stats->secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
+        stats->tput = stats->ops / (stats->secs * 1000.0);
+        if (latency_mode && !sparse_mode) {
+            if (verbose > 1)
+                printf("Timing each request.\n");
+            eval_mm_latency(trace, stats);
+        }
+        if (perfctr_mode && !sparse_mode) {
+            perfctr_start();
+            eval_mm_speed(speed_params);
+            perfctr_stop(stats->perfctr);
+        }
+    }
+
+#if 0
+    printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
+           trace->num_ops, ranges->lo_tree->comparison_count,
+           (double) ranges->lo_tree->comparison_count / trace->num_ops);
+#endif
+    free_trace(trace);
+    free_range_set(ranges);
+
+    /* clean up memory system */
+    mem_deinit();
+    return true;
+}
+
 /*
  * Run the tests; return the number of tests run (may be less than
  * num_tracefiles, if there's a timeout)
@@ -265,62 +414,509 @@ static double measure_ref_throughput(bool checkpoint);
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles,
                       stats_t *mm_stats, speed_t *speed_params) {
-    volatile int i;
+    int i;
 
-    for (i=0; i < num_tracefiles; i++) {
-        /* initialize simulated memory system in memlib.c *
-         * start each trace with a clean system */
-        mem_init(sparse_mode);
-        range_set_t *ranges = new_range_set();
+    for (i=0; i < num_tracefiles; i++)
+        if (!run_trace(i, tracedir, tracefiles[i], &mm_stats[i], speed_params))
+            return;
+}
 
+/* One worker process of run_tests_parallel */
+typedef struct {
+    pid_t pid;       /* 0 if the slot is free */
+    int trace;       /* the trace it evaluates */
+    int fd;          /* read end of the pipe its stats come back on */
+    int cpu;         /* the CPU it is pinned to */
+} worker_t;
 
-        // NOTE: If times out, then it will reread the trace file
+/*
+ * finish_worker - collect the stats of the trace of a worker that has
+ *     exited with status.  A worker that died (say, of a segfault in
+ *     mm.c) fails its trace.
+ */
+static void finish_worker(worker_t *w, int status, stats_t *mm_stats,
+                          char **tracefiles)
+{
+    int child_errors = 0;
+    stats_t *stats = &mm_stats[w->trace];
+
+    if (read(w->fd, stats, sizeof(*stats)) != sizeof(*stats) ||
+        read(w->fd, &child_errors, sizeof(child_errors)) !=
+        sizeof(child_errors)) {
+        memset(stats, 0, sizeof(*stats));
+        snprintf(stats->filename, sizeof(stats->filename), "%s",
+                 tracefiles[w->trace]);
+        child_errors = 1;
+    }
+    errors += child_errors;
+    if (WIFSIGNALED(status))
+        fprintf(stderr, "Worker for %s killed by signal %d\n",
+                tracefiles[w->trace], WTERMSIG(status));
+    close(w->fd);
+    w->pid = 0;
+}
 
-        trace_t *trace;
-        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+/*
+ * run_tests_parallel - run_tests with -j: each trace is evaluated in a
+ *     process of its own, up to jobs of them at once.  Every worker is
+ *     pinned to a CPU of its own, taken from the CPUs this process may
+ *     run on, so the timing runs do not share cores; jobs is cut down to
+ *     the number of those CPUs.  A timeout (-s) applies to each trace.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles,
+                               stats_t *mm_stats, speed_t *speed_params) {
+    cpu_set_t allowed, pinned;
+    worker_t *workers;
+    pid_t pid;
+    int i, slot, cpu, status, fds[2];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity failed in run_tests_parallel");
+    if (jobs > CPU_COUNT(&allowed)) {
+        fprintf(stderr, "Only %d CPUs to pin workers to; running %d jobs\n",
+                CPU_COUNT(&allowed), CPU_COUNT(&allowed));
+        jobs = CPU_COUNT(&allowed);
+    }
+    if ((workers = calloc(jobs, sizeof(worker_t))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+    for (slot = 0, cpu = 0; slot < jobs; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            workers[slot++].cpu = cpu;
+
+    alarm(0);                   /* the workers time themselves out */
+    for (i = 0; i < num_tracefiles; i++) {
+        /* a free slot, waiting for a worker to finish if there is none */
+        for (slot = 0; slot < jobs && workers[slot].pid != 0; slot++)
+            ;
+        while (slot == jobs) {
+            if ((pid = wait(&status)) < 0)
+                unix_error("wait failed in run_tests_parallel");
+            for (slot = 0; slot < jobs && workers[slot].pid != pid; slot++)
+                ;
+            if (slot < jobs)
+                finish_worker(&workers[slot], status, mm_stats, tracefiles);
+        }
 
-        /* Prepare for timeout */
-        if (setjmp(timeout_jmpbuf) != 0) {
-            mm_stats[i].valid = false;
-        } else {
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-                /* Do 2 tests, since may fail to reinitialize properly */
-                eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
-
-            if (onetime_flag) {
-                free_trace(trace);
-                free_range_set(ranges);
-                return;
+        if (pipe(fds) < 0)
+            unix_error("pipe failed in run_tests_parallel");
+        workers[slot].trace = i;
+        workers[slot].fd = fds[0];
+        if ((workers[slot].pid = fork()) < 0)
+            unix_error("fork failed in run_tests_parallel");
+        if (workers[slot].pid == 0) {
+            close(fds[0]);
+            errors = 0;         /* sent back as this trace's errors */
+            CPU_ZERO(&pinned);
+            CPU_SET(workers[slot].cpu, &pinned);
+            if (sched_setaffinity(0, sizeof(pinned), &pinned) < 0)
+                unix_error("sched_setaffinity failed in run_tests_parallel");
+            if (perfctr_mode) {
+                /* the counters opened by the parent count the parent */
+                const char *error;
+                perfctr_close();
+                perfctr_mode = perfctr_open(&error);
             }
+            if (set_timeout > 0)
+                alarm(set_timeout);
+            run_trace(i, tracedir, tracefiles[i], &mm_stats[i], speed_params);
+            if (write(fds[1], &mm_stats[i], sizeof(mm_stats[i])) < 0 ||
+                write(fds[1], &errors, sizeof(errors)) < 0)
+                unix_error("write failed in run_tests_parallel");
+            exit(0);
         }
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
-            mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+        close(fds[1]);
+    }
+
+    for (slot = 0; slot < jobs; slot++) {
+        if (workers[slot].pid == 0)
+            continue;
+        if (waitpid(workers[slot].pid, &status, 0) < 0)
+            unix_error("waitpid failed in run_tests_parallel");
+        finish_worker(&workers[slot], status, mm_stats, tracefiles);
+    }
+    free(workers);
+}
+
+#if MM_THREADS
+/* Per-thread state of a multithreaded replay */
+typedef struct mt_thread {
+    const trace_t *trace;
+    int thread;                /* 0 .. nthreads-1 */
+    int nthreads;
+    struct mt_thread *next;    /* thread that frees our handed-off blocks */
+    char **blocks;             /* this thread's copy of trace->blocks ... */
+    size_t *block_sizes;       /* ... and of trace->block_sizes */
+    mm_arena_t **arenas;       /* this thread's user arenas */
+    char **mailbox;            /* blocks handed to us by the previous thread */
+    char **mailbox_spare;      /* swapped with mailbox when draining */
+    int mailbox_count;
+    pthread_mutex_t mailbox_lock;
+    const char *error;         /* first error seen, or NULL */
+    int error_op;
+    bool out_of_memory;        /* the error is only an exhausted heap */
+    struct timespec start;     /* when this thread started replaying ... */
+    struct timespec end;       /* ... and when it was done */
+} mt_thread_t;
+
+static pthread_barrier_t mt_start, mt_done;
+
+/*
+ * mt_tag - the byte a thread writes at both ends of its payloads, so a
+ * block handed out to two threads at once is caught at free time
+ */
+static char mt_tag(const mt_thread_t *t) {
+    return (char)(0x40 + t->thread);
+}
+
+/*
+ * mt_check_block - return true if both end bytes still hold our tag
+ */
+static bool mt_check_block(const mt_thread_t *t, const char *p, size_t size) {
+    return size == 0 || (p[0] == mt_tag(t) && p[size - 1] == mt_tag(t));
+}
+
+/*
+ * mt_handoff - queue a block for the next thread to free
+ */
+static void mt_handoff(mt_thread_t *t, char *p) {
+    mt_thread_t *to = t->next;
+
+    pthread_mutex_lock(&to->mailbox_lock);
+    to->mailbox[to->mailbox_count] = p;
+    __atomic_store_n(&to->mailbox_count, to->mailbox_count + 1,
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&to->mailbox_lock);
+}
+
+/*
+ * mt_drain - free the blocks other threads have handed to us
+ */
+static void mt_drain(mt_thread_t *t) {
+    char **blocks;
+    int i, count;
+
+    pthread_mutex_lock(&t->mailbox_lock);
+    blocks = t->mailbox;
+    count = t->mailbox_count;
+    t->mailbox = t->mailbox_spare;
+    t->mailbox_spare = blocks;
+    __atomic_store_n(&t->mailbox_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->mailbox_lock);
+
+    for (i = 0; i < count; i++)
+        mm_free(blocks[i]);
+}
+
+/*
+ * mt_replay - thread body; replays the whole trace with private block
+ * arrays, handing every MT_HANDOFF'th free to the next thread
+ */
+static void *mt_replay(void *arg) {
+    mt_thread_t *t = arg;
+    const trace_t *trace = t->trace;
+    int i, j, frees = 0;
+
+    pthread_barrier_wait(&mt_start);
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+
+    for (i = 0; i < trace->num_ops && t->error == NULL; i++) {
+        int index = trace->ops[i].index;
+        size_t size = trace->ops[i].size;
+        char *p;
+
+        if ((i & 63) == 0 &&
+            __atomic_load_n(&t->mailbox_count, __ATOMIC_RELAXED) > 0)
+            mt_drain(t);
+
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((p = mm_malloc(size)) == NULL && size != 0) {
+                t->error = "mm_malloc failed";
+                t->out_of_memory = true;
+                break;
+            }
+            if (size > 0) {
+                if (!IS_ALIGNED(p)) {
+                    t->error = "payload is not aligned";
+                    break;
+                }
+                p[0] = p[size - 1] = mt_tag(t);
+            }
+            t->blocks[index] = p;
+            t->block_sizes[index] = size;
+            break;
+
+        case REALLOC:
+            p = t->blocks[index];
+            if (!mt_check_block(t, p, t->block_sizes[index])) {
+                t->error = "payload overwritten before mm_realloc";
+                break;
+            }
+            if ((p = mm_realloc(p, size)) == NULL && size != 0) {
+                t->error = "mm_realloc failed";
+                t->out_of_memory = true;
+                break;
+            }
+            if (size > 0) {
+                if (!IS_ALIGNED(p)) {
+                    t->error = "payload is not aligned";
+                    break;
+                }
+                if (t->block_sizes[index] > 0 && p[0] != mt_tag(t)) {
+                    t->error = "mm_realloc did not preserve the data";
+                    break;
+                }
+                p[0] = p[size - 1] = mt_tag(t);
+            }
+            t->blocks[index] = p;
+            t->block_sizes[index] = size;
+            break;
+
+        case FREE:
+            if (index < 0)
+                break;
+            p = t->blocks[index];
+            if (!mt_check_block(t, p, t->block_sizes[index])) {
+                t->error = "payload overwritten before mm_free";
+                break;
+            }
+            t->blocks[index] = NULL;
+            if (t->nthreads > 1 && ++frees % MT_HANDOFF == 0)
+                mt_handoff(t, p);
+            else
+                mm_free(p);
+            break;
+
+        case ARENA_CREATE:
+            if ((t->arenas[trace->ops[i].arena] = mm_arena_create()) == NULL) {
+                t->error = "mm_arena_create failed";
+                t->out_of_memory = true;
+            }
+            break;
+
+        case ARENA_ALLOC:
+            p = mm_arena_malloc(t->arenas[trace->ops[i].arena], size);
+            if (p == NULL && size != 0) {
+                t->error = "mm_arena_malloc failed";
+                t->out_of_memory = true;
+                break;
+            }
+            if (size > 0) {
+                if (!IS_ALIGNED(p)) {
+                    t->error = "payload is not aligned";
+                    break;
+                }
+                p[0] = p[size - 1] = mt_tag(t);
+            }
+            t->blocks[index] = p;
+            t->block_sizes[index] = size;
+            break;
+
+        case ARENA_RESET:
+            mm_arena_reset(t->arenas[trace->ops[i].arena]);
+            break;
+
+        case ARENA_DESTROY:
+            mm_arena_destroy(t->arenas[trace->ops[i].arena]);
+            t->arenas[trace->ops[i].arena] = NULL;
+            break;
+
+        case ALLOC_BATCH:
+            if (mm_malloc_batch(size, trace->ops[i].count,
+                                (void **)&t->blocks[index]) !=
+                (size_t)trace->ops[i].count) {
+                t->error = "mm_malloc_batch failed";
+                t->out_of_memory = true;
+                break;
+            }
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                p = t->blocks[j];
+                if (!IS_ALIGNED(p)) {
+                    t->error = "payload is not aligned";
+                    break;
+                }
+                p[0] = p[size - 1] = mt_tag(t);
+                t->block_sizes[j] = size;
+            }
+            break;
+
+        case FREE_BATCH:
+            for (j = index; j < index + trace->ops[i].count; j++) {
+                if (!mt_check_block(t, t->blocks[j], t->block_sizes[j])) {
+                    t->error = "payload overwritten before mm_free_batch";
+                    break;
+                }
+            }
+            mm_free_batch((void **)&t->blocks[index], trace->ops[i].count);
+            for (j = index; j < index + trace->ops[i].count; j++)
+                t->blocks[j] = NULL;
+            break;
         }
+        if (t->error != NULL)
+            t->error_op = i;
+    }
 
-#if 0
-        printf(" %d operations.  %ld comparisons.  Avg = %.1f\n",
-               trace->num_ops, ranges->lo_tree->comparison_count,
-               (double) ranges->lo_tree->comparison_count / trace->num_ops);
-#endif
-        free_trace(trace);
-        free_range_set(ranges);
+    /* Nobody hands us anything once everyone is past this point */
+    pthread_barrier_wait(&mt_done);
+    mt_drain(t);
+    clock_gettime(CLOCK_MONOTONIC, &t->end);
+    return NULL;
+}
+
+/*
+ * mt_secs - seconds from a to b
+ */
+static double mt_secs(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/*
+ * mt_run - replay trace on nthreads threads at once
+ * Returns the wall-clock seconds from the first thread starting to the
+ * last one finishing, -1 on error, or 0 if the heap ran out (a trace
+ * replayed nthreads times over may simply not fit)
+ */
+static double mt_run(const trace_t *trace, int nthreads, size_t *heapsize) {
+    mt_thread_t *threads = calloc(nthreads, sizeof(mt_thread_t));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    struct timespec *first, *last;
+    double secs;
+    int i;
+
+    if (threads == NULL || tids == NULL)
+        unix_error("calloc in mt_run failed");
+
+    for (i = 0; i < nthreads; i++) {
+        mt_thread_t *t = &threads[i];
+        t->trace = trace;
+        t->thread = i;
+        t->nthreads = nthreads;
+        t->next = &threads[(i + 1) % nthreads];
+        t->blocks = calloc(trace->num_ids, sizeof(char *));
+        t->block_sizes = calloc(trace->num_ids, sizeof(size_t));
+        t->arenas = calloc(trace->num_arenas + 1, sizeof(mm_arena_t *));
+        t->mailbox = calloc(trace->num_ops, sizeof(char *));
+        t->mailbox_spare = calloc(trace->num_ops, sizeof(char *));
+        if (t->blocks == NULL || t->block_sizes == NULL || t->arenas == NULL ||
+            t->mailbox == NULL || t->mailbox_spare == NULL)
+            unix_error("calloc in mt_run failed");
+        pthread_mutex_init(&t->mailbox_lock, NULL);
+    }
+
+    /* One heap shared by all threads; each thread gets its own arena */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in mt_run");
 
-        /* clean up memory system */
+    pthread_barrier_init(&mt_start, NULL, nthreads + 1);
+    pthread_barrier_init(&mt_done, NULL, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&tids[i], NULL, mt_replay, &threads[i]) != 0)
+            unix_error("pthread_create in mt_run failed");
+    }
+    pthread_barrier_wait(&mt_start);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&mt_start);
+    pthread_barrier_destroy(&mt_done);
+
+    first = &threads[0].start;
+    last = &threads[0].end;
+    for (i = 1; i < nthreads; i++) {
+        if (mt_secs(&threads[i].start, first) > 0)
+            first = &threads[i].start;
+        if (mt_secs(last, &threads[i].end) > 0)
+            last = &threads[i].end;
+    }
+    secs = mt_secs(first, last);
+
+    for (i = 0; i < nthreads; i++) {
+        if (threads[i].out_of_memory) {
+            secs = 0;
+        } else if (threads[i].error != NULL) {
+            malloc_error(trace, threads[i].error_op, "thread %d of %d: %s",
+                         i, nthreads, threads[i].error);
+            secs = -1;
+        }
+    }
+    if (secs > 0 && !mm_checkheap(__LINE__)) {
+        malloc_error(trace, trace->num_ops - 1,
+                     "mm_checkheap failed after %d threads", nthreads);
+        secs = -1;
+    }
+    *heapsize = mem_heapsize() + mem_mapped();
+
+    for (i = 0; i < nthreads; i++) {
+        free(threads[i].blocks);
+        free(threads[i].block_sizes);
+        free(threads[i].arenas);
+        free(threads[i].mailbox);
+        free(threads[i].mailbox_spare);
+        pthread_mutex_destroy(&threads[i].mailbox_lock);
+    }
+    free(threads);
+    free(tids);
+    return secs;
+}
+
+/*
+ * run_mt_tests - replay every trace on 1, 2, 4, ... max_threads threads
+ * sharing one heap, and print throughput and speedup over one thread
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int max_threads) {
+    int i, n, run;
+
+    for (i = 0; i < num_tracefiles; i++) {
+        stats_t stats;
+        trace_t *trace;
+        double base_tput = 0;
+
+        mem_init(sparse_mode);
+        trace = read_trace(&stats, tracedir, tracefiles[i]);
+        printf("\n%s: %d ops per thread, every %dth free done by the next thread\n",
+               trace->filename, trace->num_ops, MT_HANDOFF);
+        printf("%7s %10s %8s %10s\n", "threads", "Kops/s", "speedup",
+               "heap KB");
+
+        for (n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+            double best = -1;
+            size_t heapsize = 0;
+
+            for (run = 0; run < MT_RUNS; run++) {
+                double secs = mt_run(trace, n, &heapsize);
+                if (secs <= 0) {
+                    best = secs;
+                    break;
+                }
+                if (best < 0 || secs < best)
+                    best = secs;
+            }
+            if (best == 0) {
+                printf("%7d %10s\n", n, "out of memory");
+                break;
+            }
+            if (best < 0) {
+                printf("%7d %10s\n", n, "failed");
+                errors++;
+                break;
+            }
+
+            double tput = n * (double)trace->num_ops / (best * 1000.0);
+            if (n == 1)
+                base_tput = tput;
+            printf("%7d %10.0f %8.2f %10zu\n", n, tput, tput / base_tput,
+                   heapsize / 1024);
+            if (n == max_threads)
+                break;
+        }
+
+        free_trace(trace);
         mem_deinit();
     }
 }
+#endif /* MM_THREADS */
 
 /**************
  * Main routine
@@ -338,6 +934,7 @@ int main(int argc, char **argv)
     bool run_libc = false;     /* If set, run libc malloc (set by -l) */
     bool autograder = false;   /* if set then called by autograder (-A) */
     bool checkpoint = false;
+    bool binary_traces = false; /* If set, default traces are .bin (-b) */
 
     setbuf(stdout, 0);
     setbuf(stderr, 0);
@@ -352,7 +949,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:j:s:t:v:H:hbpOVAlDTMLP" MT_OPTS)) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -381,6 +978,10 @@ int main(int argc, char **argv)
                 strcat(tracedir, "/"); /* path always ends with "/" */
             break;
 
+        case 'b': /* Use the binary versions of the default traces */
+            binary_traces = true;
+            break;
+
         case 'l': /* Run libc malloc */
             run_libc = true;
             break;
@@ -409,6 +1010,34 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'M': /* Report peak and final resident memory */
+            memory_mode = true;
+            break;
+
+        case 'L': /* Report the latency of each type of request */
+            latency_mode = true;
+            break;
+
+        case 'P': /* Report hardware performance counters */
+            perfctr_mode = true;
+            break;
+
+        case 'H': /* Profile the heap of each trace */
+            profile_dir = optarg;
+            break;
+
+        case 'j': /* Evaluate several traces at once */
+            jobs = atoi(optarg);
+            if (jobs < 1)
+                app_error("-j needs a positive number of jobs");
+            break;
+
+        case 'm': /* Multithreaded replay (mdriver-mt only) */
+            mt_threads = atoi(optarg);
+            if (mt_threads < 1)
+                app_error("-m needs a positive thread count");
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -428,12 +1057,36 @@ int main(int argc, char **argv)
         }
         for (i = 0; default_tracefiles[i]; i++)
             add_tracefile(default_tracefiles[i]);
+
+        /* -b: load the .bin written by "make bintraces" for each */
+        for (i = 0; binary_traces && i < num_global_tracefiles; i++) {
+            char *suffix = strrchr(global_tracefiles[i], '.');
+            if (suffix != NULL && strcmp(suffix, ".rep") == 0)
+                strcpy(suffix, ".bin");
+        }
+    }
+
+    if (perfctr_mode) {
+        const char *error;
+        if (!perfctr_open(&error)) {
+            fprintf(stderr, "Hardware performance counters are unavailable "
+                    "(%s); ignoring -P\n", error);
+            perfctr_mode = false;
+        }
     }
 
     if (debug_mode != DBG_NONE) {
         init_random_data();
     }
 
+#if MM_THREADS
+    if (mt_threads > 0) {
+        run_mt_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                     mt_threads);
+        exit(errors ? 1 : 0);
+    }
+#endif
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
@@ -505,8 +1158,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
-              &speed_params);
+    if (jobs > 1)
+        run_tests_parallel(num_global_tracefiles, tracedir, global_tracefiles,
+                           mm_stats, &speed_params);
+    else
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
+                  &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -524,6 +1181,18 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (memory_mode) {
+                printmemory(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (latency_mode) {
+                printlatency(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (perfctr_mode) {
+                printperfctr(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -730,11 +1399,13 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of a region
+       the allocator mapped with mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, size)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
+                     "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return false;
     }
@@ -908,12 +1579,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index;
-    size_t size;
-    int max_index = 0;
-    int op_index;
-    int ignore = 0;
+    mtrace_header_t header;
+    const char *error = NULL;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -922,28 +1589,31 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* Read the requests, mapping a binary trace in place */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    int iweight;
-    ignore += fscanf(tracefile, "%d", &iweight);
-    trace->weight = iweight;
-    ignore += fscanf(tracefile, "%d", &trace->num_ids);
-    ignore +=  fscanf(tracefile, "%d", &trace->num_ops);
-    ignore +=  fscanf(tracefile, "%zd", &trace->data_bytes);
+    trace->ops_length = 0;
+    if (mtrace_is_binary(tracefile))
+        trace->ops = mtrace_map(tracefile, &header, &trace->ops_length, &error);
+    else
+        trace->ops = mtrace_read_rep(tracefile, &header, &error);
+    fclose(tracefile);
+    if (trace->ops == NULL)
+        app_error("%s: %s\n", trace->filename, error);
 
-    if (trace->weight > 3) {
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->data_bytes = header.data_bytes;
+    trace->num_arenas = header.num_arenas;
+
+    if (header.weight < 0 || header.weight > 3) {
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
     }
 
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
-
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
          (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
@@ -959,41 +1629,13 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
-
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            ignore += fscanf(tracefile, "%u", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
-        }
-        op_index++;
-        if (op_index == trace->num_ops) break;
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    /* the user arenas, and the blocks allocated from each */
+    if ((trace->arenas =
+         calloc(trace->num_arenas + 1, sizeof(mm_arena_t *))) == NULL ||
+        (trace->arena_first =
+         calloc(trace->num_arenas + 1, sizeof(int))) == NULL ||
+        (trace->arena_next = calloc(trace->num_ids, sizeof(int))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -1008,21 +1650,44 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
  */
 static void reinit_trace(trace_t *trace)
 {
+    int i;
+
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
     /* block_rand_base is unused if size is zero */
+    memset(trace->arenas, 0, trace->num_arenas * sizeof(*trace->arenas));
+    for (i = 0; i < trace->num_arenas; i++)
+        trace->arena_first[i] = -1;
+}
+
+/*
+ * arena_add - note that block index was allocated from user arena arena,
+ *     so that a reset of the arena can retire it.  The blocks of an arena
+ *     are visited with
+ *         for (j = trace->arena_first[arena]; j >= 0; j = trace->arena_next[j])
+ */
+static void arena_add(trace_t *trace, int arena, int index)
+{
+    trace->arena_next[index] = trace->arena_first[arena];
+    trace->arena_first[arena] = index;
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->ops_length)    /* unmap or free the arrays... */
+        mtrace_unmap(trace->ops, trace->ops_length);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->arenas);
+    free(trace->arena_first);
+    free(trace->arena_next);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -1036,8 +1701,10 @@ static void free_trace(trace_t *trace)
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
-    int i;
+    int i, j;
     int index;
+    int arena;
+    int count;
     size_t size;
     char *newp;
     char *oldp;
@@ -1058,6 +1725,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     for (i = 0;  i < trace->num_ops;  i++) {
         index = trace->ops[i].index;
         size = trace->ops[i].size;
+        arena = trace->ops[i].arena;
 
         if (debug_mode == DBG_EXPENSIVE) {
             range_t *r;
@@ -1170,6 +1838,76 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             mm_free(p);
             break;
 
+        case ARENA_CREATE: /* mm_arena_create */
+            if ((trace->arenas[arena] = mm_arena_create()) == NULL) {
+                malloc_error(trace, i, "mm_arena_create failed.");
+                return false;
+            }
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_malloc */
+            p = mm_arena_malloc(trace->arenas[arena], size);
+            if (p == NULL && size != 0) {
+                malloc_error(trace, i, "mm_arena_malloc failed.");
+                return false;
+            }
+            if (size > 0 && add_range(ranges, p, size, trace, i, index) == 0)
+                return false;
+
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            arena_add(trace, arena, index);
+            randomize_block(trace, index);
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            /* Every block of the arena must be intact up to now */
+            for (j = trace->arena_first[arena]; j >= 0;
+                 j = trace->arena_next[j]) {
+                if (!check_index(trace, i, j))
+                    allCheck = false;
+                if (trace->block_sizes[j] > 0)
+                    remove_range(ranges, trace->blocks[j]);
+                trace->blocks[j] = NULL;
+                trace->block_sizes[j] = 0;
+            }
+            trace->arena_first[arena] = -1;
+
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[arena]);
+                trace->arenas[arena] = NULL;
+            }
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count,
+                                (void **)&trace->blocks[index]) != (size_t)count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+            for (j = index; j < index + count; j++) {
+                if (add_range(ranges, trace->blocks[j], size, trace, i, j) == 0)
+                    return false;
+                trace->block_sizes[j] = size;
+                randomize_block(trace, j);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (j = index; j < index + count; j++) {
+                if (!check_index(trace, i, j))
+                    allCheck = false;
+                remove_range(ranges, trace->blocks[j]);
+                trace->block_sizes[j] = 0;
+            }
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -1184,28 +1922,37 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace. Since mem_sbrk() lets the package shrink
+ *   the heap again, heapsize is the peak size of the heap, not its
+ *   final size, and giving memory back never raises the utilization.
+ *   Regions mapped with mem_map count as part of the heap.
+ *   The peak and the bytes still resident at the end are kept in stats.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
+    int i, j;
     int index;
+    int arena;
+    int count;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    profile_t profile;
 
     reinit_trace(trace);
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package; pages touched by
+       earlier runs are dropped so that residency reflects this run only */
+    mem_discard(mem_heap_lo(), mem_heapsize());
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+    if (profile_dir != NULL)
+        profile_open(&profile, trace);
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -1261,6 +2008,74 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size -= size;
             break;
 
+        case ARENA_CREATE: /* mm_arena_create */
+            arena = trace->ops[i].arena;
+            if ((trace->arenas[arena] = mm_arena_create()) == NULL)
+                app_error("trace %d: mm_arena_create failed in eval_mm_util",
+                          tracenum);
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_malloc */
+            arena = trace->ops[i].arena;
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+
+            if ((p = mm_arena_malloc(trace->arenas[arena], size)) == NULL &&
+                size != 0) {
+                app_error("trace %d: mm_arena_malloc failed in eval_mm_util",
+                          tracenum);
+            }
+
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            arena_add(trace, arena, index);
+
+            total_size += size;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            arena = trace->ops[i].arena;
+            for (j = trace->arena_first[arena]; j >= 0;
+                 j = trace->arena_next[j]) {
+                total_size -= trace->block_sizes[j];
+                trace->block_sizes[j] = 0;
+            }
+            trace->arena_first[arena] = -1;
+
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[arena]);
+                trace->arenas[arena] = NULL;
+            }
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+
+            if (mm_malloc_batch(size, count,
+                                (void **)&trace->blocks[index]) != (size_t)count)
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            for (j = index; j < index + count; j++)
+                trace->block_sizes[j] = size;
+
+            total_size += count * size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (j = index; j < index + count; j++) {
+                total_size -= trace->block_sizes[j];
+                trace->block_sizes[j] = 0;
+            }
+            mm_free_batch((void **)&trace->blocks[index], count);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1269,25 +2084,227 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (profile_dir != NULL && ((i + 1) % profile.interval == 0 ||
+                                    i == trace->num_ops - 1))
+            profile_snapshot(&profile, i + 1, total_size);
     }
+    if (profile_dir != NULL)
+        profile_close(&profile);
 
 #if !REF_ONLY
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->peak_heap = mem_heap_peak();
+    stats->resident = mem_resident();
+
+    return ((double)max_total_size / (double)mem_heap_peak());
+}
+
+/*
+ * profile_open - start the heap profile of a trace: <dir>/<trace>.csv
+ *     gets a line per snapshot, and <dir>/<trace>.ppm the heap map
+ */
+static void profile_open(profile_t *profile, const trace_t *trace)
+{
+    const char *base = strrchr(trace->filename, '/');
+    char path[2 * MAXLINE];
+    int n;
+
+    base = base != NULL ? base + 1 : trace->filename;
+    snprintf(profile->name, sizeof(profile->name), "%s", base);
+    if (strrchr(profile->name, '.') != NULL)
+        *strrchr(profile->name, '.') = '\0';
+    snprintf(path, sizeof(path), "%s/%s.csv", profile_dir, profile->name);
+    if ((profile->csv = fopen(path, "w")) == NULL)
+        unix_error("Could not open %s for the heap profile", path);
+
+    profile->interval = (trace->num_ops + PROFILE_ROWS - 1) / PROFILE_ROWS;
+    profile->interval = profile->interval > 0 ? profile->interval : 1;
+    profile->rows = 0;
+    profile->map = malloc((PROFILE_ROWS + 1) * PROFILE_WIDTH);
+    profile->heap_size = malloc((PROFILE_ROWS + 1) * sizeof(size_t));
+    if (profile->map == NULL || profile->heap_size == NULL)
+        unix_error("malloc failed in profile_open");
+
+    fprintf(profile->csv, "op,live_bytes,heap_bytes,free_bytes,free_blocks,"
+            "largest_free,ext_frag,cached_bytes,mapped_bytes");
+    for (n = 0; n < MM_PROFILE_CLASSES; n++)
+        fprintf(profile->csv, ",free_%lu%s", 16UL << n,
+                n == MM_PROFILE_CLASSES - 1 ? "+" : "");
+    profile->csv_lists = -1;
+}
+
+/*
+ * profile_snapshot - record the heap after request op, with live payload
+ *     bytes allocated
+ */
+static void profile_snapshot(profile_t *profile, int op, size_t live)
+{
+    mm_profile_t prof;
+    int n;
+
+    mm_profile(&prof, &profile->map[profile->rows * PROFILE_WIDTH],
+               PROFILE_WIDTH);
+    profile->heap_size[profile->rows++] = mem_heapsize();
+
+    /* the list columns are known once the package has said how many */
+    if (profile->csv_lists < 0) {
+        profile->csv_lists = prof.num_lists;
+        for (n = 0; n < prof.num_lists; n++)
+            fprintf(profile->csv, ",list_%d", n);
+        fprintf(profile->csv, "\n");
+    }
+
+    fprintf(profile->csv, "%d,%zu,%zu,%zu,%zu,%zu,%.4f,%zu,%zu", op, live,
+            prof.heap_bytes, prof.free_bytes, prof.free_blocks,
+            prof.largest_free, prof.free_bytes == 0 ? 0.0 :
+            1.0 - (double)prof.largest_free / prof.free_bytes,
+            prof.cached_bytes, mem_mapped());
+    for (n = 0; n < MM_PROFILE_CLASSES; n++)
+        fprintf(profile->csv, ",%zu", prof.free_hist[n]);
+    for (n = 0; n < profile->csv_lists; n++)
+        fprintf(profile->csv, ",%zu", prof.list_blocks[n]);
+    fprintf(profile->csv, "\n");
+}
+
+/*
+ * profile_close - write the heap map, a row per snapshot, and finish.
+ *     Every row spans the largest heap of the trace; within the heap a
+ *     pixel is black where allocated and white where free, and it is
+ *     blue past the end of the heap at that time.
+ */
+static void profile_close(profile_t *profile)
+{
+    char path[2 * MAXLINE];
+    FILE *ppm;
+    size_t peak = 1, offset;
+    int r, x;
+    unsigned char gray;
+
+    if (fclose(profile->csv) != 0)
+        unix_error("Could not write the heap profile of %s", profile->name);
+
+    for (r = 0; r < profile->rows; r++)
+        peak = profile->heap_size[r] > peak ? profile->heap_size[r] : peak;
+    snprintf(path, sizeof(path), "%s/%s.ppm", profile_dir, profile->name);
+    if ((ppm = fopen(path, "w")) == NULL)
+        unix_error("Could not open %s for the heap map", path);
+    fprintf(ppm, "P6\n%d %d\n255\n", PROFILE_WIDTH, profile->rows);
+    for (r = 0; r < profile->rows; r++) {
+        for (x = 0; x < PROFILE_WIDTH; x++) {
+            offset = (size_t)((x + 0.5) * peak / PROFILE_WIDTH);
+            if (offset >= profile->heap_size[r]) {
+                fputc(64, ppm);
+                fputc(96, ppm);
+                fputc(192, ppm);
+                continue;
+            }
+            gray = 255 - profile->map[r * PROFILE_WIDTH + offset *
+                                      PROFILE_WIDTH / profile->heap_size[r]];
+            fputc(gray, ppm);
+            fputc(gray, ppm);
+            fputc(gray, ppm);
+        }
+    }
+    if (fclose(ppm) != 0)
+        unix_error("Could not write %s", path);
+    free(profile->map);
+    free(profile->heap_size);
 }
 
 
+/*
+ * mm_replay - run request i of the trace on the mm package.  Inlined
+ *    into eval_mm_speed and eval_mm_latency, which time it differently.
+ */
+static inline __attribute__((always_inline))
+void mm_replay(trace_t *trace, int i)
+{
+    int index;
+    size_t size, newsize;
+    char *p, *newp, *oldp, *block;
+
+    switch (trace->ops[i].type) {
+
+    case ALLOC: /* mm_malloc */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_malloc(size)) == NULL)
+            app_error("mm_malloc error in eval_mm_speed");
+        trace->blocks[index] = p;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        index = trace->ops[i].index;
+        newsize = trace->ops[i].size;
+        oldp = trace->blocks[index];
+        setUBCheck(false);
+        if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            app_error("mm_realloc error in eval_mm_speed");
+        setUBCheck(true);
+        trace->blocks[index] = newp;
+        break;
+
+    case FREE: /* mm_free */
+        index = trace->ops[i].index;
+        if (index < 0) {
+            block = 0;
+        } else {
+            block = trace->blocks[index];
+        }
+        mm_free(block);
+        break;
+
+    case ARENA_CREATE: /* mm_arena_create */
+        if ((trace->arenas[trace->ops[i].arena] = mm_arena_create()) == NULL)
+            app_error("mm_arena_create error in eval_mm_speed");
+        break;
+
+    case ARENA_ALLOC: /* mm_arena_malloc */
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if ((p = mm_arena_malloc(trace->arenas[trace->ops[i].arena],
+                                 size)) == NULL && size != 0)
+            app_error("mm_arena_malloc error in eval_mm_speed");
+        trace->blocks[index] = p;
+        break;
+
+    case ARENA_RESET: /* mm_arena_reset: one call, however many blocks */
+        mm_arena_reset(trace->arenas[trace->ops[i].arena]);
+        break;
+
+    case ARENA_DESTROY: /* mm_arena_destroy */
+        mm_arena_destroy(trace->arenas[trace->ops[i].arena]);
+        trace->arenas[trace->ops[i].arena] = NULL;
+        break;
+
+    case ALLOC_BATCH: /* mm_malloc_batch */
+        index = trace->ops[i].index;
+        if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+                            (void **)&trace->blocks[index]) !=
+            (size_t)trace->ops[i].count)
+            app_error("mm_malloc_batch error in eval_mm_speed");
+        break;
+
+    case FREE_BATCH: /* mm_free_batch */
+        mm_free_batch((void **)&trace->blocks[trace->ops[i].index],
+                      trace->ops[i].count);
+        break;
+
+    default:
+        app_error("Nonexistent request type in eval_mm_speed");
+    }
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index;
-    size_t size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
@@ -1298,40 +2315,87 @@ static void eval_mm_speed(void *ptr)
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+        mm_replay(trace, i);
+}
 
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-                app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+/*
+ * latency_cmp - qsort comparison of cycle counts
+ */
+static int latency_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
 
-        case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            setUBCheck(false);
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
-                app_error("mm_realloc error in eval_mm_speed");
-            setUBCheck(true);
-            trace->blocks[index] = newp;
-            break;
+/*
+ * eval_mm_latency - replay the trace once more, reading the TSC around
+ *    each request, and fill in the latency percentiles of each type of
+ *    request and the slowest requests.  The cost of the TSC reads
+ *    themselves is measured and taken off.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    int i, j, type;
+    uint64_t start, overhead = UINT64_MAX;
+    uint64_t *cycles, *sorted;
+
+    if ((cycles = malloc(trace->num_ops * sizeof(uint64_t))) == NULL ||
+        (sorted = malloc(trace->num_ops * sizeof(uint64_t))) == NULL)
+        unix_error("malloc failed in eval_mm_latency");
+
+    /* the cheapest of many back-to-back reads is the cost of one */
+    for (i = 0; i < 1000; i++) {
+        start = read_tsc();
+        start = read_tsc() - start;
+        overhead = start < overhead ? start : overhead;
+    }
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            if (index < 0) {
-                block = 0;
-            } else {
-                block = trace->blocks[index];
-            }
-            mm_free(block);
-            break;
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_latency");
+    for (i = 0; i < trace->num_ops; i++) {
+        start = read_tsc();
+        mm_replay(trace, i);
+        cycles[i] = read_tsc() - start;
+        cycles[i] = cycles[i] > overhead ? cycles[i] - overhead : 0;
+    }
 
-        default:
-            app_error("Nonexistent request type in eval_mm_speed");
-        }
+    /* percentiles by nearest rank */
+    for (type = 0; type < NUM_TYPES; type++) {
+        latency_t *lat = &stats->latency[type];
+        int n = 0;
+        for (i = 0; i < trace->num_ops; i++)
+            if ((int)trace->ops[i].type == type)
+                sorted[n++] = cycles[i];
+        lat->count = n;
+        if (n == 0)
+            continue;
+        qsort(sorted, n, sizeof(uint64_t), latency_cmp);
+        lat->p50 = sorted[(n - 1) / 2];
+        lat->p99 = sorted[(int)ceil(0.99 * n) - 1];
+        lat->p999 = sorted[(int)ceil(0.999 * n) - 1];
+        lat->max = sorted[n - 1];
+    }
+
+    /* the slowest requests, slowest first */
+    stats->num_slowest = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+        if (stats->num_slowest == NUM_SLOWEST &&
+            cycles[i] <= stats->slowest[NUM_SLOWEST - 1].cycles)
+            continue;
+        j = stats->num_slowest < NUM_SLOWEST ?
+            stats->num_slowest++ : NUM_SLOWEST - 1;
+        for (; j > 0 && stats->slowest[j - 1].cycles < cycles[i]; j--)
+            stats->slowest[j] = stats->slowest[j - 1];
+        stats->slowest[j].op = i;
+        stats->slowest[j].type = trace->ops[i].type;
+        stats->slowest[j].size = trace->ops[i].size;
+        stats->slowest[j].cycles = cycles[i];
+    }
+
+    free(cycles);
+    free(sorted);
 }
 
 /*
@@ -1342,7 +2406,7 @@ static void eval_mm_speed(void *ptr)
  */
 static bool eval_libc_valid(trace_t *trace)
 {
-    int i;
+    int i, j;
     size_t newsize;
     char *p, *newp, *oldp;
 
@@ -1377,6 +2441,43 @@ static bool eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case ARENA_CREATE: /* libc has no arenas: objects are malloc'ed */
+            break;
+
+        case ARENA_ALLOC: /* malloc */
+            if ((p = malloc(trace->ops[i].size)) == NULL &&
+                trace->ops[i].size != 0) {
+                malloc_error(trace, i, "libc malloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            arena_add(trace, trace->ops[i].arena, trace->ops[i].index);
+            break;
+
+        case ARENA_RESET: /* one free per object */
+        case ARENA_DESTROY:
+            for (j = trace->arena_first[trace->ops[i].arena]; j >= 0;
+                 j = trace->arena_next[j])
+                free(trace->blocks[j]);
+            trace->arena_first[trace->ops[i].arena] = -1;
+            break;
+
+        case ALLOC_BATCH: /* libc has no batch calls: one malloc per block */
+            for (j = trace->ops[i].index;
+                 j < trace->ops[i].index + trace->ops[i].count; j++) {
+                if ((trace->blocks[j] = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+            }
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            for (j = trace->ops[i].index;
+                 j < trace->ops[i].index + trace->ops[i].count; j++)
+                free(trace->blocks[j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1392,7 +2493,7 @@ static bool eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1429,6 +2530,40 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ARENA_CREATE: /* libc has no arenas: objects are malloc'ed */
+            break;
+
+        case ARENA_ALLOC: /* malloc */
+            index = trace->ops[i].index;
+            if ((p = malloc(trace->ops[i].size)) == NULL &&
+                trace->ops[i].size != 0)
+                unix_error("malloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            arena_add(trace, trace->ops[i].arena, index);
+            break;
+
+        case ARENA_RESET: /* one free per object */
+        case ARENA_DESTROY:
+            for (j = trace->arena_first[trace->ops[i].arena]; j >= 0;
+                 j = trace->arena_next[j])
+                free(trace->blocks[j]);
+            trace->arena_first[trace->ops[i].arena] = -1;
+            break;
+
+        case ALLOC_BATCH: /* libc has no batch calls: one malloc per block */
+            for (j = trace->ops[i].index;
+                 j < trace->ops[i].index + trace->ops[i].count; j++) {
+                if ((trace->blocks[j] = malloc(trace->ops[i].size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+            }
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            for (j = trace->ops[i].index;
+                 j < trace->ops[i].index + trace->ops[i].count; j++)
+                free(trace->blocks[j]);
+            break;
         }
     }
 }
@@ -1824,6 +2959,116 @@ static double measure_ref_throughput(bool checkpoint) {
 }
 
 
+/*
+ * printmemory - Print the peak heap size and the memory still resident
+ *   at the end of each trace.  The utilization run never writes payload
+ *   bytes, so pages only count as resident once the package touched them.
+ */
+static void printmemory(int n, stats_t *stats)
+{
+    int i;
+    size_t sumpeak = 0, sumresident = 0;
+
+    printf("Memory for mm malloc (KB):\n");
+    printf("  %10s %10s %8s  %s\n", "peak", "resident", "of peak", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) {
+            printf("  %10s %10s %8s  %s\n", "-", "-", "-", stats[i].filename);
+            continue;
+        }
+        printf("  %10zu %10zu %7.1f%%  %s\n",
+               stats[i].peak_heap / 1024, stats[i].resident / 1024,
+               stats[i].peak_heap == 0 ? 0.0 :
+               100.0 * stats[i].resident / stats[i].peak_heap,
+               stats[i].filename);
+        sumpeak += stats[i].peak_heap;
+        sumresident += stats[i].resident;
+    }
+    printf("  %10zu %10zu %7.1f%%  Total\n", sumpeak / 1024, sumresident / 1024,
+           sumpeak == 0 ? 0.0 : 100.0 * sumresident / sumpeak);
+}
+
+/*
+ * printlatency - Print the latency percentiles of each type of request,
+ *    and the slowest requests, for each trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *names[NUM_TYPES] = {
+        "malloc", "free", "realloc", "arena_create", "arena_malloc",
+        "arena_reset", "arena_destroy", "malloc_batch", "free_batch"
+    };
+    int i, type;
+
+    printf("Latency of mm malloc requests (TSC cycles):\n");
+    for (i = 0; i < n; i++) {
+        printf("%s\n", stats[i].filename);
+        if (!stats[i].valid) {
+            printf("  -\n");
+            continue;
+        }
+        printf("  %-14s %8s %8s %8s %8s %10s\n",
+               "request", "count", "p50", "p99", "p99.9", "max");
+        for (type = 0; type < NUM_TYPES; type++) {
+            latency_t *lat = &stats[i].latency[type];
+            if (lat->count == 0)
+                continue;
+            printf("  %-14s %8d %8lu %8lu %8lu %10lu\n", names[type],
+                   lat->count, (unsigned long)lat->p50,
+                   (unsigned long)lat->p99, (unsigned long)lat->p999,
+                   (unsigned long)lat->max);
+        }
+        printf("  slowest:\n");
+        for (type = 0; type < stats[i].num_slowest; type++) {
+            slow_op_t *slow = &stats[i].slowest[type];
+            printf("  %10lu  op %d (line %d) %s", (unsigned long)slow->cycles,
+                   slow->op, LINENUM(slow->op), names[slow->type]);
+            if (slow->size != 0)
+                printf(" %zu bytes", slow->size);
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * printperfctr - Print the hardware events per request of each trace,
+ *    and over all the traces; "-" for an event that was not counted
+ */
+static void printperfctr(int n, stats_t *stats)
+{
+    int i, e;
+    double sum[NUM_PERFCTRS] = { 0 };
+    double sumops = 0;
+
+    printf("Hardware events per request for mm malloc:\n");
+    printf(" ");
+    for (e = 0; e < NUM_PERFCTRS; e++)
+        printf(" %9s", perfctr_names[e]);
+    printf("  trace\n");
+    for (i = 0; i < n; i++) {
+        printf(" ");
+        for (e = 0; e < NUM_PERFCTRS; e++) {
+            if (!stats[i].valid || stats[i].perfctr[e] < 0)
+                printf(" %9s", "-");
+            else
+                printf(" %9.2f", stats[i].perfctr[e] / stats[i].ops);
+            if (stats[i].valid)
+                sum[e] += stats[i].perfctr[e];
+        }
+        printf("  %s\n", stats[i].filename);
+        if (stats[i].valid)
+            sumops += stats[i].ops;
+    }
+    printf(" ");
+    for (e = 0; e < NUM_PERFCTRS; e++) {
+        if (sumops == 0 || sum[e] < 0)
+            printf(" %9s", "-");
+        else
+            printf(" %9.2f", sum[e] / sumops);
+    }
+    printf("  Total\n");
+}
+
 /*
  * usage - Explain the command line arguments
  */
@@ -1836,11 +3081,20 @@ static void usage(char *prog)
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> twice, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-b         Use the binary (.bin) versions of the default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-M         Report peak heap vs. final resident memory\n");
+    fprintf(stderr, "\t-L         Report per-request latency percentiles and the slowest requests\n");
+    fprintf(stderr, "\t-P         Report hardware performance counters per request\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once, each pinned to a CPU\n");
+    fprintf(stderr, "\t-H <dir>   Write a heap profile and heap map of each trace to <dir>\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+#if MM_THREADS
+    fprintf(stderr, "\t-m <n>     Replay each trace on 1, 2, 4, ... <n> threads at once\n");
+#endif
 }
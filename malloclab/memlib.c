@@ -14,6 +14,10 @@
  * map(emulated address / PAGE_SIZE) -> mem_block_t
  * map(mem_block_t, emulated address % PAGE_SIZE) -> byte(s)
  *
+ * The first map is an open-addressed hash table, probed linearly, with the
+ *  last page looked up cached in front of it: most accesses fall in the
+ *  same page as the one before.
+ *
  * This mapping is for a single address; however, accesses can span two blocks
  *  so the mapping sequence checks accounts for size and can perform two
  *  lookups if necessary.
@@ -31,7 +35,14 @@
  *  in non-emulation, as it was to the same page as actual heap data.  But
  *  sparse emulation has tighter checks.  Commonly, the CPU reports a
  *  BUS ERROR on these accesses, and should be debugged as segmentation faults.
+ *
+ * Apart from the heap, mem_map hands out page-aligned regions, as a model of
+ *  mmap for very large blocks.  In dense mode these are real anonymous
+ *  mappings.  In sparse mode they are placed in the upper half of the
+ *  emulated address range, which is emulated like the heap; the heap is
+ *  limited to the lower half.
  */
+#define _GNU_SOURCE                         /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -49,26 +60,40 @@
 /* Data structure used to implement pages in sparse memory emulation */
 typedef struct MBLK {
     size_t id;                             /* Page ID.  Counts number of pages from start of heap */
-    struct MBLK *next;                     /* Link for hash table */
-    unsigned char initSet[SPARSE_PAGE_SIZE / 8];
+    struct MBLK *next;                     /* Link for free and taken lists */
+    uint64_t initSet[SPARSE_PAGE_SIZE / 64]; /* Bytes written, a bit each */
     unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
 } mem_block_t;
 
+/* A region handed out by mem_map */
+typedef struct mem_region {
+    unsigned char *start;
+    size_t length;                         /* Multiple of the page size */
+    struct mem_region *next;               /* Next region by address */
+} mem_region_t;
+
 /* private global variables */
 static bool sparse = false;                 /* Use sparse memory emulation */
 static unsigned char *heap;                 /* Starting address of heap */
 static unsigned char *mem_brk;              /* Current position of break */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static size_t mem_peak;                     /* Largest heap + mapped bytes since last reset */
+static mem_region_t *regions = NULL;        /* Mapped regions, sorted by address */
+static size_t mapped_bytes = 0;             /* Total length of mapped regions */
+static unsigned char *map_lo, *map_hi;      /* Sparse address range for regions */
 static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
 static bool show_stats = false;             /* Should program print allocation information? */
 static bool stats_printed = false;          /* Has information been printed about allocation */
 
 /* Sparse memory representation */
 static mem_block_t *next_free_page = NULL;  /* Next free page */
+static mem_block_t *recycled_pages = NULL;  /* Pages given back by unmapped regions */
 static size_t num_pages = 0;                /* Total number of pages */
 static size_t num_free_pages = 0;           /* Number of free pages */
 static mem_block_t **page_table = NULL;     /* Hash table from page ID to page */
-static size_t num_buckets = 0;              /* Number of buckets in page table */
+static size_t num_slots = 0;                /* Number of slots in page table, a power of 2 */
+static unsigned int slot_shift = 0;         /* 64 - log2(num_slots) */
+static mem_block_t *last_page = NULL;       /* Page of the last lookup, or NULL */
 
 static bool checkUB = true;                 /* should sparse check for UB */
 
@@ -83,6 +108,17 @@ void setUBCheck(bool val)
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
 static void *get_mem(const void *addr, size_t, bool);
+static size_t page_slot(size_t id);
+static void remove_page(size_t slot);
+static bool emulated(const void *addr, size_t len);
+static mem_block_t *take_pages(const void *addr, size_t len);
+static void drop_pages(const void *addr, size_t len);
+static void move_pages(const void *from, const void *to, size_t len);
+static unsigned char *find_gap(size_t len);
+static mem_region_t **find_region(void *addr, size_t len);
+static void link_region(mem_region_t *region);
+static void unmap_all(void);
+static void note_peak(void);
 static void print_stats();
 
 /* 
@@ -95,9 +131,11 @@ void mem_init(bool do_sparse){
         /* Account for both page itself and its amortized contribution to the page table */
         double fbytes_per_page = sizeof(mem_block_t) + sizeof(mem_block_t *) / HASH_LOAD;
         num_pages = (size_t) (MAX_DENSE_HEAP / fbytes_per_page);
-        num_buckets = num_pages / HASH_LOAD;
+        for (num_slots = 1, slot_shift = 64; num_slots < num_pages / HASH_LOAD;
+             num_slots *= 2)
+            slot_shift--;
         mmap_length =
-            num_buckets * sizeof(mem_block_t *) +  // Page table
+            num_slots * sizeof(mem_block_t *) +    // Page table
             num_pages * sizeof(mem_block_t) +      // Pages
             sizeof(uint64_t);                      // Padding
         setUBCheck(true);
@@ -106,7 +144,7 @@ void mem_init(bool do_sparse){
         next_free_page = NULL;
         num_pages = 0;
         page_table = NULL;
-        num_buckets = 0;
+        num_slots = 0;
         mmap_length = MAX_DENSE_HEAP;
     }
 
@@ -126,7 +164,9 @@ void mem_init(bool do_sparse){
         /* Use initial space for page table */
         page_table = (mem_block_t **) addr;
         heap = SPARSE_HEAP_START;
-        mem_max_addr = heap + MAX_SPARSE_HEAP;
+        mem_max_addr = heap + MAX_SPARSE_HEAP / 2;
+        map_lo = mem_max_addr;
+        map_hi = heap + MAX_SPARSE_HEAP;
     } else {
         heap = addr;
         mem_max_addr = heap + MAX_DENSE_HEAP;
@@ -141,45 +181,67 @@ void mem_init(bool do_sparse){
  */
 void mem_deinit(void){
     print_stats();
+    unmap_all();
     munmap(heap, mmap_length);
     next_free_page = NULL;
     num_free_pages = 0;
     page_table = NULL;
-    num_buckets = 0;
+    num_slots = 0;
+    last_page = NULL;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *                 and unmap all regions
  */
 void mem_reset_brk(){
     print_stats();
+    unmap_all();
     if (sparse) {
         /* Clear page table */
-        size_t ptb = num_buckets * sizeof(mem_block_t *);
+        size_t ptb = num_slots * sizeof(mem_block_t *);
         memset((void *) page_table, 0, ptb);
+        last_page = NULL;
         /* First page is just beyond page table */
         next_free_page = (mem_block_t *) ((unsigned char *) page_table + ptb);
         num_free_pages = num_pages;
+        recycled_pages = NULL;
     }
     mem_brk = heap;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *                by incr bytes and returns the start address of the new area. In
- *                this model, the heap cannot be shrunk.
+ *                by incr bytes and returns the start address of the new area.
+ *                A negative incr shrinks the heap, like sbrk does, and the
+ *                pages past the new break are given back.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
     bool ok = true;
     if (incr < 0) {
-        ok = false;
-        fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
+        if (mem_brk + incr < heap) {
+            ok = false;
+            fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to shrink heap by %ld bytes below its start\n", (long) -incr);
+        } else {
+            /*
+             * The process break is left alone: libc malloc may have
+             * grown it since, so only the pages themselves are released.
+             */
+            mem_brk += incr;
+            mem_discard(mem_brk, (size_t) -incr);
+            return (void *) old_brk;
+        }
     } else if (mem_brk + incr > mem_max_addr) {
         ok = false;
         size_t alloc = mem_brk - heap + incr;
         fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
+    } else if (!sparse && mem_heapsize() + mapped_bytes + incr > MAX_DENSE_HEAP) {
+        ok = false;
+        size_t alloc = mem_heapsize() + mapped_bytes + incr;
+        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require %zd (0x%zx) bytes with mapped regions\n", alloc, alloc);
     } else if (!sparse && sbrk(incr) == (void*) -1) {
         ok = false;
         fprintf(stderr, "ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
@@ -187,6 +249,7 @@ void *mem_sbrk(intptr_t incr) {
 
     if (ok) {
         mem_brk += incr;
+        note_peak();
         return (void *) old_brk;
     } else {
         errno = ENOMEM;
@@ -222,6 +285,234 @@ size_t mem_pagesize(){
     return (size_t) getpagesize();
 }
 
+/*
+ * mem_heap_peak() - returns the largest heap size plus mapped bytes
+ *                   since the last reset
+ */
+size_t mem_heap_peak() {
+    return mem_peak;
+}
+
+/*
+ * mem_mapped() - returns the number of bytes in mapped regions
+ */
+size_t mem_mapped() {
+    return mapped_bytes;
+}
+
+/*
+ * mem_map - model of an anonymous mmap.  Maps len bytes, rounded up to
+ *           whole pages, apart from the heap and returns the page-aligned
+ *           start, or (void *) -1 on failure.  In dense mode the heap and
+ *           the regions together are limited to MAX_DENSE_HEAP.
+ */
+void *mem_map(size_t len) {
+    size_t pagesize = mem_pagesize();
+    mem_region_t *region;
+    unsigned char *start;
+
+    len = (len + pagesize - 1) & ~(pagesize - 1);
+    if (len == 0) {
+        errno = EINVAL;
+        return (void *) -1;
+    }
+    if (sparse) {
+        if ((start = find_gap(len)) == NULL) {
+            fprintf(stderr, "ERROR: mem_map failed.  No room for %zu bytes\n", len);
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+    } else {
+        if (mem_heapsize() + mapped_bytes + len > MAX_DENSE_HEAP) {
+            size_t alloc = mem_heapsize() + mapped_bytes + len;
+            fprintf(stderr, "ERROR: mem_map failed.  Ran out of memory.  Would require %zd (0x%zx) bytes with the heap\n", alloc, alloc);
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        start = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (start == MAP_FAILED) {
+            fprintf(stderr, "ERROR: mem_map failed.  mmap: %s\n", strerror(errno));
+            return (void *) -1;
+        }
+    }
+
+    if ((region = malloc(sizeof(mem_region_t))) == NULL) {
+        fprintf(stderr, "ERROR: mem_map failed.  Could not allocate region\n");
+        if (!sparse)
+            munmap(start, len);
+        errno = ENOMEM;
+        return (void *) -1;
+    }
+    region->start = start;
+    region->length = len;
+    link_region(region);
+    mapped_bytes += len;
+    note_peak();
+    return start;
+}
+
+/*
+ * mem_unmap - model of munmap.  Unmaps the region that mem_map returned
+ *             at addr; len must be the length it was mapped with.
+ */
+void mem_unmap(void *addr, size_t len) {
+    mem_region_t **link = find_region(addr, len);
+    mem_region_t *region;
+
+    if (link == NULL) {
+        fprintf(stderr, "ERROR: mem_unmap failed.  No region of %zu bytes at %p\n",
+                len, addr);
+        return;
+    }
+    region = *link;
+    *link = region->next;
+    if (sparse)
+        drop_pages(region->start, region->length);
+    else
+        munmap(region->start, region->length);
+    mapped_bytes -= region->length;
+    free(region);
+}
+
+/*
+ * mem_remap - model of mremap with MREMAP_MAYMOVE.  Resizes the region
+ *             that mem_map returned at addr from old_len to new_len bytes,
+ *             keeping its contents.  Returns the new start, which may
+ *             differ from addr, or (void *) -1 on failure, in which case
+ *             the region is left as it was.
+ */
+void *mem_remap(void *addr, size_t old_len, size_t new_len) {
+    size_t pagesize = mem_pagesize();
+    mem_region_t **link = find_region(addr, old_len);
+    mem_region_t *region;
+    unsigned char *start;
+
+    new_len = (new_len + pagesize - 1) & ~(pagesize - 1);
+    if (link == NULL || new_len == 0) {
+        fprintf(stderr, "ERROR: mem_remap failed.  No region of %zu bytes at %p\n",
+                old_len, addr);
+        errno = EINVAL;
+        return (void *) -1;
+    }
+    region = *link;
+    old_len = region->length;
+    start = region->start;
+
+    if (sparse) {
+        unsigned char *end = region->next != NULL ? region->next->start : map_hi;
+        if (new_len < old_len) {
+            drop_pages(start + new_len, old_len - new_len);
+        } else if ((size_t) (end - start) < new_len) {
+            /* No room to grow in place: take the pages along to a new gap */
+            if ((start = find_gap(new_len)) == NULL) {
+                fprintf(stderr, "ERROR: mem_remap failed.  No room for %zu bytes\n", new_len);
+                errno = ENOMEM;
+                return (void *) -1;
+            }
+            move_pages(region->start, start, old_len);
+        }
+    } else {
+        if (new_len > old_len &&
+                mem_heapsize() + mapped_bytes + new_len - old_len > MAX_DENSE_HEAP) {
+            size_t alloc = mem_heapsize() + mapped_bytes + new_len - old_len;
+            fprintf(stderr, "ERROR: mem_remap failed.  Ran out of memory.  Would require %zd (0x%zx) bytes with the heap\n", alloc, alloc);
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        start = mremap(start, old_len, new_len, MREMAP_MAYMOVE);
+        if (start == MAP_FAILED) {
+            fprintf(stderr, "ERROR: mem_remap failed.  mremap: %s\n", strerror(errno));
+            return (void *) -1;
+        }
+    }
+
+    if (start != region->start) {
+        *link = region->next;
+        region->start = start;
+        link_region(region);
+    }
+    region->length = new_len;
+    mapped_bytes = mapped_bytes - old_len + new_len;
+    note_peak();
+    return start;
+}
+
+/*
+ * mem_is_mapped - true if [addr, addr + len) lies within one region
+ */
+bool mem_is_mapped(const void *addr, size_t len) {
+    const unsigned char *lo = addr;
+    mem_region_t *region;
+
+    for (region = regions; region != NULL && region->start <= lo;
+         region = region->next) {
+        if ((size_t) (lo - region->start) + len <= region->length)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * mem_discard - release the whole pages in [addr, addr + len), as
+ *               madvise(MADV_DONTNEED) does.  Partial pages at either end
+ *               are kept.  Sparse emulation never gives pages back.
+ */
+void mem_discard(void *addr, size_t len) {
+    uintptr_t pagesize = mem_pagesize();
+    uintptr_t lo = ((uintptr_t) addr + pagesize - 1) & ~(pagesize - 1);
+    uintptr_t hi = ((uintptr_t) addr + len) & ~(pagesize - 1);
+
+    if (sparse || hi <= lo)
+        return;
+    if (madvise((void *) lo, hi - lo, MADV_DONTNEED) < 0)
+        fprintf(stderr, "ERROR: mem_discard failed.  madvise(%p, %zu): %s\n",
+                (void *) lo, (size_t) (hi - lo), strerror(errno));
+}
+
+/*
+ * mem_resident - number of heap and mapped bytes backed by physical memory, as
+ *                reported by mincore.  In sparse mode, the bytes of the
+ *                emulation pages in use.
+ */
+size_t mem_resident() {
+    size_t pagesize = mem_pagesize();
+    size_t npages = (mem_heapsize() + pagesize - 1) / pagesize;
+    size_t i, resident = 0;
+    unsigned char *vec;
+    mem_region_t *region;
+
+    if (sparse)
+        return (num_pages - num_free_pages) * SPARSE_PAGE_SIZE;
+    if (npages > 0) {
+        if ((vec = malloc(npages)) == NULL || mincore(heap, npages * pagesize, vec) < 0) {
+            fprintf(stderr, "ERROR: mem_resident failed.  mincore: %s\n", strerror(errno));
+            free(vec);
+            return 0;
+        }
+        for (i = 0; i < npages; i++)
+            resident += vec[i] & 1;
+        /* the last page is only partly heap */
+        resident *= pagesize;
+        if (vec[npages - 1] & 1)
+            resident -= npages * pagesize - mem_heapsize();
+        free(vec);
+    }
+
+    for (region = regions; region != NULL; region = region->next) {
+        npages = region->length / pagesize;
+        if ((vec = malloc(npages)) == NULL || mincore(region->start, region->length, vec) < 0) {
+            fprintf(stderr, "ERROR: mem_resident failed.  mincore: %s\n", strerror(errno));
+            free(vec);
+            continue;
+        }
+        for (i = 0; i < npages; i++)
+            resident += (vec[i] & 1) * pagesize;
+        free(vec);
+    }
+    return resident;
+}
+
 /*************** Memory emulation  *******************/
 
 __int128 mem_read128(const void* addr)
@@ -241,8 +532,7 @@ void mem_write128(void* addr, __int128 val)
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
-    if (sparse &&
-            (unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    if (emulated(addr, len)) {
         /* Heap read.  Check if it crosses page boundary */
         size_t id = page_id(addr);
         void *paddr = get_mem(addr, len, false);
@@ -279,8 +569,7 @@ uint64_t mem_read(const void *addr, size_t len) {
 
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len) {
-    if (sparse &&
-            (unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    if (emulated(addr, len)) {
         /* Heap write.  Check to see if it crosses page boundary */
         size_t id = page_id(addr);
         void *paddr = get_mem(addr, len, true);
@@ -413,70 +702,221 @@ static void *page_start(size_t id) {
     return (void *) ((unsigned char *) SPARSE_HEAP_START + offset);
 }
 
+/* Slot of page ID in the page table: the one holding it, or the empty
+ *  slot where it would go */
+static size_t page_slot(size_t id) {
+    size_t mask = num_slots - 1;
+    size_t slot = (id * 0x9e3779b97f4a7c15UL) >> slot_shift;
+    mem_block_t *block;
+
+    while ((block = page_table[slot]) != NULL && block->id != id)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/* Empty a slot of the page table, moving the pages after it in its probe
+ *  run back so that every page stays reachable from its home slot */
+static void remove_page(size_t slot) {
+    size_t mask = num_slots - 1;
+    size_t next, home;
+
+    page_table[slot] = NULL;
+    for (next = (slot + 1) & mask; page_table[next] != NULL; next = (next + 1) & mask) {
+        home = (page_table[next]->id * 0x9e3779b97f4a7c15UL) >> slot_shift;
+        /* Move unless home lies cyclically in (slot, next] */
+        if (slot <= next ? (home <= slot || home > next)
+                         : (home <= slot && home > next)) {
+            page_table[slot] = page_table[next];
+            page_table[next] = NULL;
+            slot = next;
+        }
+    }
+    last_page = NULL;
+}
+
 /* Get memory to store value.  Allocate page if necessary */
 static void *get_mem(const void *addr, size_t size, bool isWrite) {
     size_t id = page_id(addr);
-    size_t b = id % num_buckets; // A very simple hash function
-    unsigned int i;
-
-    mem_block_t *block = page_table[b];
-    while (block && block->id != id)
-        block = block->next;
-    if (!block) {
-        /* Need to allocate a new block */
-        if (num_free_pages == 0) {
-            /*
-             * This will often fail due to student code that either accesses
-             *  too many memory locations, such as checking every byte in a
-             *  block.  Or more commonly due to poor utilization, such as 
-             *  leaking or not finding the huge allocations.
-             */
-            fprintf(stderr, "FAILURE.  Ran out of memory for emulation\n");
-            exit(1);
+    mem_block_t *block = last_page;
+
+    if (block == NULL || block->id != id) {
+        size_t slot = page_slot(id);
+        block = page_table[slot];
+        if (!block) {
+            /* Need to allocate a new block */
+            if (num_free_pages == 0) {
+                /*
+                 * This will often fail due to student code that either accesses
+                 *  too many memory locations, such as checking every byte in a
+                 *  block.  Or more commonly due to poor utilization, such as
+                 *  leaking or not finding the huge allocations.
+                 */
+                fprintf(stderr, "FAILURE.  Ran out of memory for emulation\n");
+                exit(1);
+            }
+            if (recycled_pages != NULL) {
+                block = recycled_pages;
+                recycled_pages = block->next;
+            } else {
+                block = next_free_page++;
+            }
+            num_free_pages--;
+            block->id = id;
+            memset(block->initSet, 0, sizeof(block->initSet));
+            page_table[slot] = block;
         }
-        block = next_free_page++;
-        num_free_pages--;
-        block->id = id;
-        block->next = page_table[b];
-        for (i = 0; i < (SPARSE_PAGE_SIZE / 8); i++)
-            block->initSet[i] = 0;
-        page_table[b] = block;
+        last_page = block;
     }
 
     // Convert an emulated address into an offset
     void *saddr = page_start(id);
     size_t offset = (unsigned char *) addr - (unsigned char *) saddr;
-
-    // Compute the bit vector lookup for this 'offset'
-    size_t offsetIdx = offset / 8;
-    size_t offsetBit = offset & 0x7;
-
-    // For each byte in this access, update the bitvector that tracks
-    //  the use / initialization of emulated bytes.
-    for (i = 0; i < size; i++)
-    {
+    size_t end = offset + size < SPARSE_PAGE_SIZE ? offset + size : SPARSE_PAGE_SIZE;
+
+    // Update the bitvector that tracks the use / initialization of
+    //  emulated bytes, a word of it at a time.
+    while (offset < end) {
+        size_t w = offset / 64, bit = offset % 64;
+        size_t n = end - offset < 64 - bit ? end - offset : 64 - bit;
+        uint64_t mask = (n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1) << bit;
         if (isWrite)
         {
-            block->initSet[offsetIdx] |= (0x1 << offsetBit);
+            block->initSet[w] |= mask;
         }
-        else if (checkUB && (block->initSet[offsetIdx] & (0x1 << offsetBit)) == 0)
+        else if (checkUB && (block->initSet[w] & mask) != mask)
         {
-            // The student code has attempted to read an address that was 
+            // The student code has attempted to read an address that was
             //  never written to.  Students should set a breakpoint on this
             //  line / check and then backtrace to where their code has
             //  made the memory access.
-            fprintf(stderr, "Attempt to read uninitialized address %p, see %s:%d for details\n", (addr + i), __FILE__, __LINE__);
+            size_t first = w * 64 + __builtin_ctzll(~block->initSet[w] & mask);
+            fprintf(stderr, "Attempt to read uninitialized address %p, see %s:%d for details\n", (unsigned char *) saddr + first, __FILE__, __LINE__);
             exit(1);
         }
-        offsetBit++;
-        if (offsetBit == 8)
-        {
-            offsetBit = 0;
-            offsetIdx++;
+        offset += n;
+    }
+
+    return (void *) &block->bytes[(unsigned char *) addr - (unsigned char *) saddr];
+}
+
+
+/* Is the access to emulated memory: the sparse heap or a sparse region? */
+static bool emulated(const void *addr, size_t len) {
+    const unsigned char *lo = addr;
+    if (!sparse)
+        return false;
+    return (lo >= heap && lo + len <= mem_brk) ||
+           (lo >= map_lo && lo + len <= map_hi);
+}
+
+/*
+ * Unlink the pages in [addr, addr + len) from the page table and return
+ *  them as a list.  A region may span far more page IDs than there are
+ *  slots, in which case the table is scanned rather than the range.
+ */
+static mem_block_t *take_pages(const void *addr, size_t len) {
+    size_t lo = page_id(addr);
+    size_t hi = page_id((const unsigned char *) addr + len);
+    mem_block_t *taken = NULL;
+    size_t id, slot;
+
+    if (hi - lo < num_slots) {
+        for (id = lo; id < hi; id++) {
+            slot = page_slot(id);
+            if (page_table[slot] != NULL) {
+                page_table[slot]->next = taken;
+                taken = page_table[slot];
+                remove_page(slot);
+            }
+        }
+        return taken;
+    }
+    for (slot = 0; slot < num_slots; slot++) {
+        /* A removal can move a later page into this slot: look again */
+        while (page_table[slot] != NULL && page_table[slot]->id >= lo &&
+               page_table[slot]->id < hi) {
+            page_table[slot]->next = taken;
+            taken = page_table[slot];
+            remove_page(slot);
         }
-        if (offsetIdx == (SPARSE_PAGE_SIZE / 8)) break;
     }
+    return taken;
+}
 
-    return (void *) &block->bytes[offset];
+/* Give the pages in [addr, addr + len) back for reuse */
+static void drop_pages(const void *addr, size_t len) {
+    mem_block_t *block = take_pages(addr, len);
+    while (block != NULL) {
+        mem_block_t *next = block->next;
+        block->next = recycled_pages;
+        recycled_pages = block;
+        num_free_pages++;
+        block = next;
+    }
 }
 
+/* Move the pages in [from, from + len) to the same offsets from to */
+static void move_pages(const void *from, const void *to, size_t len) {
+    mem_block_t *block = take_pages(from, len);
+    size_t shift_from = page_id(from), shift_to = page_id(to);
+    while (block != NULL) {
+        mem_block_t *next = block->next;
+        block->id = block->id - shift_from + shift_to;
+        page_table[page_slot(block->id)] = block;
+        block = next;
+    }
+}
+
+/* First gap of len bytes among the sparse regions, or NULL */
+static unsigned char *find_gap(size_t len) {
+    unsigned char *start = map_lo;
+    mem_region_t *region;
+
+    for (region = regions; region != NULL; region = region->next) {
+        if ((size_t) (region->start - start) >= len)
+            return start;
+        start = region->start + region->length;
+    }
+    return (size_t) (map_hi - start) >= len ? start : NULL;
+}
+
+/* The link to the region at addr, if it is len bytes long, or NULL */
+static mem_region_t **find_region(void *addr, size_t len) {
+    size_t pagesize = mem_pagesize();
+    mem_region_t **link = &regions;
+
+    while (*link != NULL && (*link)->start != addr)
+        link = &(*link)->next;
+    if (*link == NULL ||
+            (*link)->length != ((len + pagesize - 1) & ~(pagesize - 1)))
+        return NULL;
+    return link;
+}
+
+/* Insert a region into the list, keeping it sorted by address */
+static void link_region(mem_region_t *region) {
+    mem_region_t **link = &regions;
+    while (*link != NULL && (*link)->start < region->start)
+        link = &(*link)->next;
+    region->next = *link;
+    *link = region;
+}
+
+/* Unmap every region; sparse pages are reclaimed with the page table */
+static void unmap_all(void) {
+    while (regions != NULL) {
+        mem_region_t *region = regions;
+        regions = region->next;
+        if (!sparse)
+            munmap(region->start, region->length);
+        free(region);
+    }
+    mapped_bytes = 0;
+}
+
+/* Record the heap plus mapped bytes if they are the most so far */
+static void note_peak(void) {
+    size_t footprint = mem_heapsize() + mapped_bytes;
+    if (footprint > mem_peak)
+        mem_peak = footprint;
+}
@@ -7,11 +7,17 @@ void mem_deinit(void);
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *            by incr bytes and returns the start address of the new area. In
- *            this model, the heap cannot be shrunk.
+ *            by incr bytes and returns the start address of the new area.
+ *            A negative incr shrinks the heap and releases its pages.
  */
 void *mem_sbrk(intptr_t incr);
 
+/*
+ * mem_discard - model of madvise(MADV_DONTNEED). Releases the whole pages
+ *               in [addr, addr + len); they read back as zero when touched.
+ */
+void mem_discard(void *addr, size_t len);
+
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
@@ -30,6 +36,37 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Largest heap size plus mapped bytes since the last mem_reset_brk */
+size_t mem_heap_peak(void);
+
+/* Number of heap and mapped bytes currently backed by physical memory */
+size_t mem_resident(void);
+
+/*
+ * mem_map - model of an anonymous mmap. Maps a page-aligned region of at
+ *           least len bytes apart from the heap, or returns (void *) -1.
+ */
+void *mem_map(size_t len);
+
+/*
+ * mem_unmap - model of munmap. Unmaps the whole region mem_map returned
+ *             at addr; len must be the length it was mapped with.
+ */
+void mem_unmap(void *addr, size_t len);
+
+/*
+ * mem_remap - model of mremap with MREMAP_MAYMOVE. Resizes a region,
+ *             keeping its contents, and returns its possibly moved start,
+ *             or (void *) -1 with the region unchanged.
+ */
+void *mem_remap(void *addr, size_t old_len, size_t new_len);
+
+/* Is [addr, addr + len) inside one mapped region? */
+bool mem_is_mapped(const void *addr, size_t len);
+
+/* Total bytes in mapped regions */
+size_t mem_mapped(void);
+
 /* Functions used for memory emulation */
 
 /* Read len bytes and return value zero-extended to 64 bits */
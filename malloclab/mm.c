@@ -12,10 +12,44 @@
  *    
  *  1. Use segerageted list to hold free blocks.
  *  2. Use LIFO to insert new free block in each list.
- *  3. Use first fit to search for a free block when mallocing.
+ *  3. Free blocks of tree_min_size bytes and up are kept in a treap
+ *  ordered by size, which gives malloc the true best fit for them; smaller
+ *  sizes take the best of the first RANGE blocks that fit in the lists.
  *  4. Remove footer of allocated blocks. The allocated blocks only have
  *  header (block size, prev block allocated, this block allocated). 
  *  Free blocks have header, prev pointer, next pointer and footer.                                                                    
+ *  5. realloc resizes in place when it can: it shrinks by splitting off
+ *  the tail, and grows into a free successor or, for the last block, by
+ *  extending the heap right behind it.
+ *  6. With -DTLSF=1 the lists above 16 bytes are replaced by a two-level
+ *  segregated fit (TLSF) index: a power-of-two first level, SL_COUNT linear
+ *  second-level lists per class, and bitmaps so that find_fit locates a
+ *  non-empty list that is guaranteed to fit with two count-trailing-zeros.
+ *  7. Small blocks are cached on free in exact-size LIFO bins (tcache) and
+ *  handed straight back by malloc. Cached blocks stay marked allocated, so
+ *  neighbours never coalesce with them; a bin that grows too long, or a
+ *  malloc that would otherwise extend the heap, flushes them back to the
+ *  segregated lists. With -DDEFER_COALESCE=1 every freed block is cached,
+ *  the larger ones in a bin of their own, and all of them are coalesced in
+ *  one batch once they exceed DEFER_LIMIT bytes.
+ *  8. Requests of up to 32 bytes are served from slabs: 1 KB heap
+ *  blocks, aligned to their size, that are cut into objects of 16 or 32
+ *  bytes with no header, whose use is tracked in a bitmap at the start of
+ *  the slab. A bitmap over the slab-sized pieces of the heap tells free
+ *  which pointers are slab objects.
+ *  9. A block of at least map_threshold bytes that does not fit in the
+ *  heap gets a region of its own from mem_map instead of growing it; free
+ *  hands the region back whole and realloc resizes it with mem_remap. The
+ *  threshold rises to the size of each mapped block freed, so sizes that
+ *  come and go repeatedly stay in the heap.
+ *  10. mm_arena_create returns a user arena for phase-structured programs:
+ *  mm_arena_malloc bumps a pointer through chunks that are ordinary
+ *  allocated blocks, and mm_arena_reset / mm_arena_destroy free the
+ *  chunks, so that all objects of a phase go back to the lists with one
+ *  free per chunk rather than one per object.
+ *  11. When nothing fits, the heap grows by only what a free block at its
+ *  end lacks, but by at least a step that doubles while the heap keeps
+ *  growing and halves once frees catch up with it.
  *  ************************************************************************  *
  *  ** ADVICE FOR STUDENTS. **                                                *
  *  Step 0: Please read the writeup!                                          *
@@ -34,9 +68,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "mm.h"
+#include "sizeclass.h"
 
 /* Do not change the following! */
 
@@ -56,6 +92,68 @@
 //
 #define RANGE 9
 
+// build with -DTLSF=1 to use the two-level segregated fit engine
+#ifndef TLSF
+#define TLSF 0
+#endif
+
+#if TLSF
+// log2 of the number of second-level lists in each first-level class
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+// sizes below 1 << (SL_LOG2 + 4) form class 0, then one class per power of 2
+#define FL_COUNT (64 - (SL_LOG2 + 4) + 1)
+#endif
+
+// the number of tcache bins, one per block size 16, 32, ..., 16 * TCACHE_BINS
+#define TCACHE_BINS 32
+
+// build with -DDEFER_COALESCE=1 to defer the coalescing of every freed block:
+// larger blocks are cached too, in one extra bin of mixed sizes, and the bins
+// are only emptied in a batch, when they hold more than DEFER_LIMIT bytes or
+// a malloc finds no fit
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE 0
+#endif
+
+// Count the block sizes that reach the lists, for sizetune
+#ifndef SIZE_STATS
+#define SIZE_STATS 0
+#endif
+
+#if DEFER_COALESCE
+#ifndef DEFER_LIMIT
+#define DEFER_LIMIT (64 << 10)
+#endif
+#endif
+
+// the number of tcache lists, counting the bin of larger blocks
+#define TCACHE_LISTS (TCACHE_BINS + DEFER_COALESCE)
+
+// the number of slab classes, one per object size 16, 32, ..., 16 * SLAB_CLASSES
+#define SLAB_CLASSES 2
+// log2 of the slab size
+#define SLAB_LOG2 10
+// slab-sized pieces of the heap that may hold slabs: those of the 100 MB
+// dense heap
+#define SLAB_MAP_SIZE ((100 << 20) >> SLAB_LOG2)
+// bitmap words of a slab, one bit per 16 bytes
+#define SLAB_BITMAP ((1 << SLAB_LOG2) / 16 / 64)
+
+// build with -DMM_THREADS=1 for the thread-safe multi-arena allocator
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+
+#if MM_THREADS
+// threads are assigned to the arenas round robin
+#define ARENA_COUNT 8
+// chunks covered by the arena map: the 100 MB heap of the dense driver
+#define ARENA_MAP_SIZE ((100 << 20) / (1 << 12))
+#else
+#define ARENA_COUNT 1
+#endif
+
 /* You can change anything from here onward */
 
 /*
@@ -96,7 +194,7 @@ static const size_t dsize = 2 * wsize;
 // Minimum block size (bytes)
 static const size_t min_block_size = 2 * dsize;
 
-// TODO: explain what chunksize is
+// Smallest heap extension, and the size of the heap after mm_init
 // (Must be divisible by dsize)
 static const size_t chunksize = (1 << 12);
 
@@ -107,6 +205,67 @@ static const word_t prev_alloc_mask = 0x2;
 
 static const word_t prev_16B_mask = 0x4;
 
+// The block has a region of its own from mem_map
+static const word_t mapped_mask = 0x8;
+
+// Largest request served from a slab
+static const size_t slab_max_size = SLAB_CLASSES * 2 * sizeof(word_t);
+
+// Size and alignment of a slab
+static const size_t slab_size = (size_t)1 << SLAB_LOG2;
+
+// Largest block size kept in the tcache
+static const size_t tcache_max_size = TCACHE_BINS * 2 * sizeof(word_t);
+
+#if !DEFER_COALESCE
+// A bin longer than this is flushed down to half of it
+static const int tcache_limit = 16;
+#endif
+
+// Free space at the end of the heap above this is given back at first...
+static const size_t trim_threshold_min = (size_t)1 << 20;
+
+#if !MM_THREADS
+// ...and the threshold doubles up to this each time the heap grows back
+static const size_t trim_threshold_max = (size_t)1 << 25;
+#endif
+
+#if !MM_THREADS
+// The heap extension step doubles up to this during sustained growth, and
+// to no more than the heap size >> grow_step_shift
+static const size_t grow_step_max = (size_t)1 << 20;
+static const int grow_step_shift = 5;
+#endif
+
+// The pages inside a free block this large are given back to the system
+static const size_t discard_threshold = (size_t)1 << 20;
+
+// Blocks this large are mapped at first; freeing a mapped block raises the
+// threshold to its size, up to the maximum
+static const size_t map_threshold_min = (size_t)1 << 17;
+static const size_t map_threshold_max = (size_t)1 << 25;
+
+// A batch malloc takes at most this many bytes from one free region
+static const size_t batch_max_size = (size_t)1 << 20;
+
+// Payload sizes of the first and of the largest chunks of a user arena; a
+// chunk of the minimum size fills one chunksize block
+static const size_t bump_chunk_min = (1 << 12) - sizeof(word_t);
+static const size_t bump_chunk_max = (1 << 16) - sizeof(word_t);
+
+// Bytes in front of the objects of a user arena chunk: the chunk link and
+// a pad that keeps the objects 16-byte aligned
+static const size_t bump_offset = 2 * sizeof(word_t);
+
+// Words in front of the header of a mapped block: the links of the
+// mapped list and a pad that keeps the payload 16-byte aligned
+static const size_t map_offset = 3 * sizeof(word_t);
+
+#if !TLSF
+// Free blocks of at least this size (list SIZE - 1) are kept in a tree
+static const size_t tree_min_size = 141 * 2 * sizeof(word_t);
+#endif
+
 // TODO: explain what size_mask is
 static const word_t size_mask = ~(word_t)0xF;
 
@@ -141,9 +300,105 @@ typedef struct block {
    */
 } block_t;
 
+/* Start of a slab, followed by its objects */
+typedef struct slab {
+  // slabs of the same class with a free object
+  struct slab *next;
+  struct slab *prev;
+  uint16_t size;     // object size
+  uint16_t shift;    // log2 of the object size
+  uint16_t used;     // objects in use
+  uint16_t capacity; // objects that fit
+  word_t bitmap[SLAB_BITMAP]; // one bit per object slot, set if in use or unusable
+} slab_t;
+
+/* Free lists and caches of an arena; each thread allocates from one */
+typedef struct arena {
+  block_t *root_list[SIZE];
+  block_t *tcache[TCACHE_LISTS];
+  int tcache_count[TCACHE_LISTS];
+#if DEFER_COALESCE
+  // bytes held by all bins
+  size_t tcache_bytes;
+#endif
+  slab_t *slabs[SLAB_CLASSES];
+#if TLSF
+  // TLSF lists of free blocks of at least 32 bytes, and which are non-empty
+  block_t *tlsf_list[FL_COUNT][SL_COUNT];
+  uint64_t tlsf_fl_bitmap;
+  uint32_t tlsf_sl_bitmap[FL_COUNT];
+#endif
+#if MM_THREADS
+  pthread_mutex_t lock;
+  // blocks freed by other threads, pushed without taking the lock
+  block_t *remote_free;
+#endif
+} arena_t;
+
+/* A user arena from mm_arena_create (unrelated to the per-thread arena_t) */
+struct mm_arena {
+  // payloads of all chunks, newest first, linked through their first word
+  void *chunks;
+  // free space of the newest chunk, which objects are bumped out of
+  char *next;
+  char *end;
+  // payload size of the next chunk
+  size_t chunk_size;
+};
+
+/* A heap map being drawn by mm_profile, one cell after another */
+typedef struct {
+  unsigned char *map;
+  size_t cells;
+  word_t lo;   // first byte of the heap
+  size_t span; // bytes of the heap
+  size_t cell; // the cell being summed
+  double used; // allocated bytes summed in it so far
+} heap_map_t;
+
 /* Global variables */
 static block_t *heap_start;
-static block_t *root_list[SIZE];
+static arena_t arenas[ARENA_COUNT];
+
+// one bit per slab-sized piece of the heap, set if the piece is a slab
+static word_t slab_map[SLAB_MAP_SIZE / 64];
+
+#if MM_THREADS
+// the arena of the calling thread, assigned on its first malloc
+static __thread arena_t *cur_arena;
+static unsigned int next_arena;
+
+// owner of each chunk of the heap: 0 if none, else 1 + the arena index
+static unsigned char arena_map[ARENA_MAP_SIZE];
+
+// serializes mem_sbrk, mem_map and the mapped list, the arena map, and
+// the lazy mm_init
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static arena_t *const cur_arena = &arenas[0];
+
+// Current trim threshold, and whether the heap was trimmed since it grew
+static size_t trim_threshold;
+static bool heap_trimmed;
+
+// Current heap extension step, and the bytes freed since the heap grew
+static size_t grow_step;
+static size_t grow_freed;
+#endif
+
+// All mapped blocks, and the size from which blocks are mapped
+static block_t *mapped_list;
+static size_t map_threshold;
+
+#if SIZE_STATS
+size_t mm_size_stats[2][MM_SIZE_STATS];
+#endif
+
+#if TLSF
+// Blocks smaller than this map linearly into first-level class 0
+static const size_t tlsf_small_size = (size_t)1 << (SL_LOG2 + 4);
+#endif
 
 /* Function prototypes for internal helper routines */
 
@@ -152,7 +407,25 @@ bool mm_checkheap(int lineno);
 static block_t *extend_heap(size_t size);
 static block_t *find_fit(size_t asize);
 static block_t *coalesce_block(block_t *block);
+static void free_block(block_t *block);
+static void release_block(block_t *block, block_t *freed, size_t freed_size);
+#if !MM_THREADS
+static void *grow_heap(size_t size);
+static size_t heap_tail_size(void);
+#endif
+static size_t heap_step(size_t size);
+static block_t *map_block(size_t asize);
+static void unmap_block(block_t *block);
+static block_t *remap_block(block_t *block, size_t asize);
+static void *mapped_region(block_t *block);
+static void mapped_link(block_t *block);
+static void mapped_unlink(block_t *block);
+static void map_lock(void);
+static void map_unlock(void);
+static bool check_mapped(int line);
 static void split_block(block_t *block, size_t asize, size_t block_size);
+static void shrink_block(block_t *block, size_t asize);
+static bool resize_block(block_t *block, size_t asize);
 
 static size_t max(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
@@ -167,6 +440,8 @@ static bool extract_alloc(word_t header);
 static bool get_alloc(block_t *block);
 static bool get_prev_alloc(block_t *block);
 static bool get_prev_16B(block_t *block);
+static bool get_mapped(block_t *block);
+static bool is_mapped(block_t *block);
 
 static void write_header(block_t *block, size_t size, bool alloc, bool prev, bool prev_16B);
 static void write_footer(block_t *block, size_t size, bool alloc, bool prev, bool prev_16B);
@@ -191,6 +466,69 @@ static void set_prev_16B(block_t *block, bool prev_16B);
 static void insert_node(block_t *root_item[SIZE], block_t *node);
 static void delete_node(block_t *root_list[SIZE], block_t *node);
 static int find_listnumber(size_t size);
+static block_t **list_head(block_t *root_list[SIZE], size_t size);
+static bool check_list(int line, block_t **head, size_t *count);
+static bool check_blocks(int line, block_t *first, size_t *free_count, size_t *size);
+static void profile_blocks(block_t *first, mm_profile_t *profile, heap_map_t *hm);
+static void map_add(heap_map_t *hm, word_t start, word_t end, double used);
+static void map_to(heap_map_t *hm, size_t c);
+
+#if TLSF
+static int floor_log2(size_t x);
+static void tlsf_mapping(size_t size, int *fl, int *sl);
+#else
+static block_t **tree_left(block_t *node);
+static block_t **tree_right(block_t *node);
+static block_t **tree_parent(block_t *node);
+static bool tree_less(block_t *a, block_t *b);
+static word_t tree_priority(block_t *node);
+static void tree_rotate_left(block_t **root, block_t *x);
+static void tree_rotate_right(block_t **root, block_t *x);
+static void tree_replace(block_t **root, block_t *u, block_t *v);
+static block_t *tree_minimum(block_t *node);
+static block_t *tree_successor(block_t *node);
+static void tree_insert(block_t **root, block_t *node);
+static void tree_remove(block_t **root, block_t *node);
+static block_t *tree_find_fit(block_t *root, size_t asize);
+static bool check_tree(int line, block_t **root, size_t *count);
+#endif
+
+static int tcache_index(size_t size);
+static void tcache_put(block_t *block);
+static block_t *tcache_get(size_t asize);
+static void tcache_flush(int index, int keep);
+static bool tcache_flush_all(void);
+
+static slab_t *slab_of(void *bp);
+static void *slab_malloc(size_t size);
+static slab_t *slab_new(int index);
+static void slab_free(slab_t *slab, void *bp);
+static void slab_release(slab_t *slab);
+static bool slab_flush_all(void);
+static void slab_link(slab_t *slab);
+static void slab_unlink(slab_t *slab);
+static size_t slab_first(size_t size);
+static size_t slab_last(size_t size);
+static bool check_slabs(int line);
+
+static void *bump_chunk(mm_arena_t *arena, size_t size);
+
+static void init_once(void);
+static size_t arena_malloc_batch(size_t size, size_t n, void **out);
+static block_t *carve_blocks(block_t *block, size_t asize, size_t n, void **out);
+static int address_cmp(const void *a, const void *b);
+
+static void recycle_block(block_t *block);
+static void *arena_malloc(size_t size);
+static arena_t *arena_of(block_t *block);
+static void arena_acquire(void);
+static void arena_release(void);
+#if MM_THREADS
+static void arena_remote_free(arena_t *owner, block_t *block);
+static void arena_drain(void);
+static void *arena_sbrk(size_t size, void *end);
+static bool check_segments(int line, size_t *free_count);
+#endif
 
 /*
  * mm_init: to initialize a heap.
@@ -206,22 +544,67 @@ bool mm_init(void) {
     return false;
   }
   int i = 0;
-  for (i = 0; i < SIZE; i++) {
-    root_list[i] = 0;
+  for (int a = 0; a < ARENA_COUNT; a++) {
+    arena_t *arena = &arenas[a];
+    for (i = 0; i < SIZE; i++) {
+      arena->root_list[i] = 0;
+    }
+    for (i = 0; i < TCACHE_LISTS; i++) {
+      arena->tcache[i] = NULL;
+      arena->tcache_count[i] = 0;
+    }
+#if DEFER_COALESCE
+    arena->tcache_bytes = 0;
+#endif
+    for (i = 0; i < SLAB_CLASSES; i++) {
+      arena->slabs[i] = NULL;
+    }
+#if TLSF
+    for (i = 0; i < FL_COUNT; i++) {
+      for (int j = 0; j < SL_COUNT; j++) {
+        arena->tlsf_list[i][j] = NULL;
+      }
+      arena->tlsf_sl_bitmap[i] = 0;
+    }
+    arena->tlsf_fl_bitmap = 0;
+#endif
+#if MM_THREADS
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->remote_free = NULL;
+#endif
+  }
+
+#if MM_THREADS
+  // the first segment belongs to the first arena, and so does this thread
+  for (i = 0; i < ARENA_MAP_SIZE; i++) {
+    arena_map[i] = 0;
+  }
+  arena_map[0] = 1;
+  cur_arena = &arenas[0];
+  next_arena = 1;
+#else
+  trim_threshold = trim_threshold_min;
+  heap_trimmed = false;
+  grow_step = chunksize;
+  grow_freed = 0;
+#endif
+  mapped_list = NULL;
+  map_threshold = map_threshold_min;
+  for (i = 0; i < SLAB_MAP_SIZE / 64; i++) {
+    slab_map[i] = 0;
   }
 
   start[0] = pack(0, true, true, false); // Heap prologue (block footer)
   start[1] = pack(0, true, false, false); // Heap epilogue (block header)
 
-  // Heap starts with first "block header", currently the epilogue
-  heap_start = (block_t *)&start[1];
-  root_list[SIZE - 1] = (block_t *)&start[1];
-
   // Extend the empty heap with a free block of chunksize bytes
   if (extend_heap(chunksize) == NULL) {
     return false;
   }
 
+  // Heap starts with first "block header"; published last for lazy init
+  __atomic_store_n(&heap_start, (block_t *)&start[1], __ATOMIC_RELEASE);
+
   return true;
 }
 
@@ -232,6 +615,43 @@ bool mm_init(void) {
  * return: the payload address of a allocated block
  */
 void *malloc(size_t size) {
+  init_once();
+
+  arena_acquire();
+  void *bp = arena_malloc(size);
+  arena_release();
+  return bp;
+}
+
+/*
+ * init_once: to initialize the heap on the first malloc if mm_init has not
+ * been called.
+ * args: none
+ * return: void
+ */
+static void init_once(void) {
+  if (__atomic_load_n(&heap_start, __ATOMIC_ACQUIRE) == NULL) // Initialize heap if it isn't initialized
+  {
+#if MM_THREADS
+    pthread_mutex_lock(&init_lock);
+    if (heap_start == NULL) {
+      mm_init();
+    }
+    pthread_mutex_unlock(&init_lock);
+#else
+    mm_init();
+#endif
+  }
+}
+
+/*
+ * arena_malloc: to malloc payload from the arena of the calling thread,
+ * whose lock is held.
+ * args:
+ * size_t size: the size of input
+ * return: the payload address of a allocated block
+ */
+static void *arena_malloc(size_t size) {
   dbg_requires(mm_checkheap(__LINE__));
 
   size_t asize;      // Adjusted block size
@@ -239,33 +659,61 @@ void *malloc(size_t size) {
   block_t *block;
   void *bp = NULL;
 
-  bool result = (root_list[0] == NULL);
-
-  for (int i = 1; i < SIZE; i++) {
-  	result = result && (root_list[i] == NULL);
-  }
-
-  if (result) // Initialize heap if it isn't initialized
-  {
-    mm_init();
-  }
-
   if (size == 0) // Ignore spurious request
   {
     dbg_ensures(mm_checkheap(__LINE__));
     return bp;
   }
 
+  // Small requests that a header would push into the next block size are
+  // packed into slabs instead; the others fit a block just as tightly
+  if (size <= slab_max_size && size % dsize > wsize) {
+    bp = slab_malloc(size);
+    if (bp != NULL) {
+      dbg_ensures(mm_checkheap(__LINE__));
+      return bp;
+    }
+  }
+
   // Adjust block size to include overhead and to meet alignment requirements
   asize = round_up(size + wsize, dsize);
 
+  // A recently freed block of exactly this size is already marked allocated
+  block = tcache_get(asize);
+  if (block != NULL) {
+    bp = header_to_payload(block);
+    dbg_ensures(mm_checkheap(__LINE__));
+    return bp;
+  }
+
   // Search the free list for a fit
   block = find_fit(asize);
 
+  // Give cached blocks and empty slabs back to the lists before growing
+  // the heap
+  if (block == NULL) {
+    bool flushed = tcache_flush_all();
+    if (slab_flush_all()) {
+      flushed = true;
+    }
+    if (flushed) {
+      block = find_fit(asize);
+    }
+  }
+
+  // A large block gets a region of its own rather than growing the heap
+  if (block == NULL && asize >= __atomic_load_n(&map_threshold, __ATOMIC_RELAXED)) {
+    block = map_block(asize);
+    if (block != NULL) {
+      bp = header_to_payload(block);
+      dbg_ensures(mm_checkheap(__LINE__));
+      return bp;
+    }
+  }
+
   // If no fit is found, request more memory, and then and place the block
   if (block == NULL) {
-    // Always request at least chunksize
-    extendsize = max(asize, chunksize);
+    extendsize = heap_step(asize);
 
     block = extend_heap(extendsize);
     if (block == NULL) // extend_heap returns an error
@@ -298,17 +746,71 @@ void *malloc(size_t size) {
  * return: void
  */
 void free(void *bp) {
-  dbg_requires(mm_checkheap(__LINE__));
-
   if (bp == NULL) {
     return;
   }
 
   block_t *block = payload_to_header(bp);
-  size_t size = get_size(block);
+  bool in_slab = slab_of(bp) != NULL; // then there is no header
+
+  if (!in_slab && is_mapped(block)) {
+    unmap_block(block);
+    return;
+  }
+
+#if MM_THREADS
+  // only the owner may touch the lists, so hand the block over
+  arena_t *owner = arena_of(block);
+  if (owner != cur_arena) {
+    arena_remote_free(owner, block);
+    return;
+  }
+#endif
+
+  arena_acquire();
+  dbg_requires(mm_checkheap(__LINE__));
 
   // The block should be marked as allocated
-  dbg_assert(get_alloc(block));
+  dbg_assert(in_slab || get_alloc(block));
+
+#if !MM_THREADS
+  grow_freed += in_slab ? 0 : get_size(block);
+#endif
+
+  recycle_block(block);
+
+  dbg_ensures(mm_checkheap(__LINE__));
+  arena_release();
+}
+
+/*
+ * recycle_block: to give an allocated block back to its arena.
+ * Slab objects go back to their slab, and small blocks (all blocks with
+ * DEFER_COALESCE) wait in the tcache for the next malloc of the same size.
+ * args:
+ * block_t *block: the block being freed, or the word before a slab object
+ * return: void
+ */
+static void recycle_block(block_t *block) {
+  slab_t *slab = slab_of(header_to_payload(block));
+  if (slab != NULL) {
+    slab_free(slab, header_to_payload(block));
+  } else if (DEFER_COALESCE || get_size(block) <= tcache_max_size) {
+    tcache_put(block);
+  } else {
+    free_block(block);
+  }
+}
+
+/*
+ * free_block: to return an allocated block to the segregated lists.
+ * args:
+ * block_t *block: the block to be freed
+ * return: void
+ */
+static void free_block(block_t *block) {
+  void *bp = header_to_payload(block);
+  size_t size = get_size(block);
 
   //check if the prev block is allocated to set the prev_alloc
   bool prev_alloc = get_prev_alloc(block);
@@ -324,108 +826,730 @@ void free(void *bp) {
   }
 
   // Try to coalesce the block with its neighbors
+  block_t *freed = block;
   block = coalesce_block(block);
 
-  dbg_ensures(mm_checkheap(__LINE__));
+  if (get_size(block) >= trim_threshold_min) {
+    release_block(block, freed, size);
+  }
 }
 
 /*
- * realloc: realloc size-byte payload of an allocated block to a new block.
+ * release_block: to give the memory of a large free block back to the
+ * system. At the end of the heap the block is cut back to chunksize and
+ * the heap shrunk behind it. Elsewhere its pages are discarded, to be
+ * faulted back in on reuse; a neighbour it absorbed that was already
+ * this large had its pages discarded before, so it is skipped.
  * args:
- * void *ptr: the payload address of a malloced block.
- * size_t size: the size of payload to realloc
- * return: a new payload address after realloc
+ * block_t *block: a free block that is on the free lists
+ * block_t *freed: the block that was freed and coalesced into it
+ * size_t freed_size: the size of that block
+ * return: void
  */
-void *realloc(void *ptr, size_t size) {
-  block_t *block = payload_to_header(ptr);
-  size_t copysize;
-  void *newptr;
-
-  // If size == 0, then free block and return NULL
-  if (size == 0) {
-    free(ptr);
-    return NULL;
-  }
+static void release_block(block_t *block, block_t *freed, size_t freed_size) {
+  size_t size = get_size(block);
 
-  // If ptr is NULL, then equivalent to malloc
-  if (ptr == NULL) {
-    return malloc(size);
+#if !MM_THREADS
+  // an arena's last block need not end at the break, so only trim here
+  if (get_size(find_next(block)) == 0 && size - chunksize >= trim_threshold) {
+    if (mem_sbrk(-(intptr_t)(size - chunksize)) == (void *)-1) {
+      return;
+    }
+    heap_trimmed = true;
+    grow_step = chunksize;
+    delete_node(cur_arena->root_list, block);
+    write_header(block, chunksize, false, true, get_prev_16B(block));
+    write_footer(block, chunksize, false, true, get_prev_16B(block));
+    insert_node(cur_arena->root_list, block);
+    write_header(find_next(block), 0, true, false, false); // new epilogue
+    return;
   }
+#endif
 
-  // Otherwise, proceed with reallocation
-  newptr = malloc(size);
+  if (size >= discard_threshold) {
+    char *lo = (char *)block;
+    char *hi = (char *)block + size;
+    if ((size_t)((char *)freed - lo) >= discard_threshold) {
+      lo = (char *)freed;
+    }
+    if ((size_t)(hi - ((char *)freed + freed_size)) >= discard_threshold) {
+      hi = (char *)freed + freed_size;
+    }
 
-  // If malloc fails, the original block is left untouched
-  if (newptr == NULL) {
-    return NULL;
+    // whole pages, but not the header, the three link words a tree node
+    // uses or the footer of the block
+    word_t page_mask = mem_pagesize() - 1;
+    char *first = (char *)header_to_payload(block) + 3 * wsize;
+    char *last = (char *)header_to_footer(block);
+    lo = (char *)((word_t)lo & ~page_mask);
+    hi = (char *)(((word_t)hi + page_mask) & ~page_mask);
+    lo = lo > first ? lo : first;
+    hi = hi < last ? hi : last;
+    if (lo < hi) {
+      mem_discard(lo, hi - lo);
+    }
   }
+}
 
-  // Copy the old data
-  copysize = get_payload_size(block); // gets size of old payload
-  if (size < copysize) {
-    copysize = size;
+#if !MM_THREADS
+/*
+ * grow_heap: to extend the heap by size bytes. Growing back after a trim
+ * means the trimmed memory was still needed, so the trim threshold is
+ * doubled to stop the heap from shrinking and growing on every phase.
+ * args:
+ * size_t size: the number of bytes to add
+ * return: the start of the new area, or (void *)-1 if out of memory
+ */
+static void *grow_heap(size_t size) {
+  if (heap_trimmed) {
+    heap_trimmed = false;
+    if (trim_threshold < trim_threshold_max) {
+      trim_threshold *= 2;
+    }
   }
-  memcpy(newptr, ptr, copysize);
-
-  // Free the old block
-  free(ptr);
+  return mem_sbrk(size);
+}
 
-  return newptr;
+/*
+ * heap_tail_size: the size of the free block at the end of the heap, which
+ * an extension coalesces with
+ * return: its size, or 0 if the last block is allocated
+ */
+static size_t heap_tail_size(void) {
+  block_t *epilogue = (block_t *)((char *)mem_heap_hi() + 1 - wsize);
+  if (get_prev_alloc(epilogue)) {
+    return 0;
+  }
+  if (get_prev_16B(epilogue)) {
+    return dsize;
+  }
+  return extract_size(*((word_t *)epilogue - 1));
 }
+#endif
 
 /*
- * calloc: Allocates memory for an array of nmemb elements of size bytes each and returns a pointer to the allocated memory.
- * The memory is set to zero before returning.
+ * heap_step: how far to extend the heap for a block of size bytes that
+ * no free block fits. A free block at the end of the heap is extended in
+ * place, so only the bytes it lacks are needed. The rest of the step
+ * adapts: it doubles each time the heap grows with fewer bytes freed
+ * since the last extension than that extension added, so that sustained
+ * growth takes few mem_sbrk calls, and halves when frees dominate, so
+ * that the heap ends close to its peak use.
  * args:
- * size_t elements: the number of elements
- * size_t size: the size of each element
- * return: a pointer pointed to the payload of allocated block.
+ * size_t size: the adjusted size of the block
+ * return: the number of bytes to extend the heap by
  */
-void *calloc(size_t elements, size_t size) {
-  void *bp;
-  size_t asize = elements * size;
+static size_t heap_step(size_t size) {
+#if MM_THREADS
+  return max(size, chunksize);
+#else
+  size_t tail = heap_tail_size();
+  size_t need = tail < size ? size - tail : 0;
 
-  if (asize / elements != size) {
-    // Multiplication overflowed
-    return NULL;
+  if (grow_freed < grow_step) {
+    size_t limit = mem_heapsize() >> grow_step_shift;
+    if (grow_step * 2 <= grow_step_max && grow_step * 2 <= limit) {
+      grow_step *= 2;
+    }
+  } else if (grow_step > chunksize) {
+    grow_step /= 2;
   }
+  grow_freed = 0;
+  return max(need, grow_step);
+#endif
+}
 
-  bp = malloc(asize);
-  if (bp == NULL) {
-    return NULL;
+/*
+ * map_block: to allocate a block in a region of its own. The region is
+ * whole pages and starts with the links of the mapped list, so the block
+ * header sits map_offset bytes in and the size in it is that of the
+ * whole region.
+ * args:
+ * size_t asize: the adjusted block size, header included
+ * return: the allocated block, or NULL if the region cannot be mapped
+ */
+static block_t *map_block(size_t asize) {
+  size_t length = round_up(asize + map_offset, mem_pagesize());
+  block_t *block = NULL;
+
+  map_lock();
+  char *region = mem_map(length);
+  if (region != (void *)-1) {
+    block = (block_t *)(region + map_offset);
+    block->header = pack(length, true, true, false) | mapped_mask;
+    mapped_link(block);
   }
-
-  // Initialize all bits to 0
-  memset(bp, 0, asize);
-
-  return bp;
+  map_unlock();
+  return block;
 }
 
-/******** The remaining content below are helper and debug routines ********/
-
 /*
- * extend_heap: to extend the heap size when the heap is initialized or there is no block fit.
+ * unmap_block: to free a mapped block by unmapping its region. Blocks of
+ * this size are not worth a region each if they are freed again and
+ * again, so the threshold is raised to the size of the block.
  * args:
- * size_t size: the size to extend
- * return:
- * a block_t pointer pointed to the extended block (after coalescing)
+ * block_t *block: a mapped block
+ * return: void
  */
-static block_t *extend_heap(size_t size) {
-  void *bp;
-
-  // Allocate an even number of words to maintain alignment
-  size = round_up(size, dsize);
-  if ((bp = mem_sbrk(size)) == (void *)-1) {
-    return NULL;
+static void unmap_block(block_t *block) {
+  size_t length = get_size(block);
+
+  map_lock();
+  mapped_unlink(block);
+  mem_unmap(mapped_region(block), length);
+  if (length > map_threshold && length <= map_threshold_max) {
+    __atomic_store_n(&map_threshold, length, __ATOMIC_RELAXED);
   }
+  map_unlock();
+}
 
-  // Initialize free block header/footer
-  block_t *block = payload_to_header(bp);
-
-  //check if the prev block is allocated
-  bool prev_alloc = get_prev_alloc(block);
+/*
+ * remap_block: to resize a mapped block with mem_remap, which grows the
+ * region in place or moves its pages rather than copying the payload.
+ * args:
+ * block_t *block: a mapped block
+ * size_t asize: the new adjusted block size, header included
+ * return: the block at its new address, or NULL if it is unchanged
+ */
+static block_t *remap_block(block_t *block, size_t asize) {
+  size_t length = round_up(asize + map_offset, mem_pagesize());
+
+  map_lock();
+  mapped_unlink(block);
+  char *region = mem_remap(mapped_region(block), get_size(block), length);
+  if (region == (void *)-1) {
+    mapped_link(block);
+    block = NULL;
+  } else {
+    block = (block_t *)(region + map_offset);
+    block->header = pack(length, true, true, false) | mapped_mask;
+    mapped_link(block);
+  }
+  map_unlock();
+  return block;
+}
 
-  bool prev_16B = get_prev_16B(block);
+/*
+ * is_mapped: to tell whether an allocated block, maybe of another arena,
+ * is mapped. That arena may be rewriting the low bits of the header
+ * under its lock, so with threads the address decides instead: regions
+ * never overlap the heap the arena map covers.
+ * args:
+ * block_t *block: an allocated block
+ * return: true if the block has a region of its own
+ */
+static bool is_mapped(block_t *block) {
+#if MM_THREADS
+  return (word_t)block - (word_t)mem_heap_lo() >= (word_t)ARENA_MAP_SIZE * chunksize;
+#else
+  return get_mapped(block);
+#endif
+}
+
+/*
+ * mapped_region: returns the start of the region of a mapped block.
+ */
+static void *mapped_region(block_t *block) {
+  return (char *)block - map_offset;
+}
+
+/*
+ * mapped_link: to push a mapped block on the mapped list; the next and
+ * prev links are the first two words of its region.
+ */
+static void mapped_link(block_t *block) {
+  word_t *links = mapped_region(block);
+  put(&links[0], (word_t)mapped_list);
+  put(&links[1], 0);
+  if (mapped_list != NULL) {
+    put((word_t *)mapped_region(mapped_list) + 1, (word_t)block);
+  }
+  mapped_list = block;
+}
+
+/*
+ * mapped_unlink: to take a mapped block off the mapped list.
+ */
+static void mapped_unlink(block_t *block) {
+  word_t *links = mapped_region(block);
+  block_t *next = get(&links[0]);
+  block_t *prev = get(&links[1]);
+  if (prev != NULL) {
+    put(mapped_region(prev), (word_t)next);
+  } else {
+    mapped_list = next;
+  }
+  if (next != NULL) {
+    put((word_t *)mapped_region(next) + 1, (word_t)prev);
+  }
+}
+
+/*
+ * map_lock: to serialize mem_map and the mapped list between threads.
+ */
+static void map_lock(void) {
+#if MM_THREADS
+  pthread_mutex_lock(&sbrk_lock);
+#endif
+}
+
+/*
+ * map_unlock: to release the lock taken by map_lock.
+ */
+static void map_unlock(void) {
+#if MM_THREADS
+  pthread_mutex_unlock(&sbrk_lock);
+#endif
+}
+
+/*
+ * realloc: realloc size-byte payload of an allocated block to a new block.
+ * args:
+ * void *ptr: the payload address of a malloced block.
+ * size_t size: the size of payload to realloc
+ * return: a new payload address after realloc
+ */
+void *realloc(void *ptr, size_t size) {
+  block_t *block = payload_to_header(ptr);
+  slab_t *slab = slab_of(ptr);
+  size_t copysize;
+  void *newptr;
+
+  // If size == 0, then free block and return NULL
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  // If ptr is NULL, then equivalent to malloc
+  if (ptr == NULL) {
+    return malloc(size);
+  }
+
+  // A slab object has a fixed size; it stays if it is big enough
+  if (slab != NULL) {
+    if (size <= slab->size) {
+      return ptr;
+    }
+  }
+  // A mapped block stays mapped; its pages move rather than its bytes
+  else if (is_mapped(block)) {
+    block_t *moved = remap_block(block, round_up(size + wsize, dsize));
+    if (moved != NULL) {
+      return header_to_payload(moved);
+    }
+  }
+  // Resize in place if the neighbourhood allows it, without copying;
+  // only the owning arena may touch the neighbourhood
+  else if (arena_of(block) == cur_arena) {
+    arena_acquire();
+    bool resized = resize_block(block, round_up(size + wsize, dsize));
+    dbg_ensures(mm_checkheap(__LINE__));
+    arena_release();
+    if (resized) {
+      return ptr;
+    }
+  }
+
+  // Otherwise, proceed with reallocation
+  newptr = malloc(size);
+
+  // If malloc fails, the original block is left untouched
+  if (newptr == NULL) {
+    return NULL;
+  }
+
+  // Copy the old data
+  copysize = slab != NULL ? slab->size : get_payload_size(block); // gets size of old payload
+  if (size < copysize) {
+    copysize = size;
+  }
+  memcpy(newptr, ptr, copysize);
+
+  // Free the old block
+  free(ptr);
+
+  return newptr;
+}
+
+/*
+ * calloc: Allocates memory for an array of nmemb elements of size bytes each and returns a pointer to the allocated memory.
+ * The memory is set to zero before returning.
+ * args:
+ * size_t elements: the number of elements
+ * size_t size: the size of each element
+ * return: a pointer pointed to the payload of allocated block.
+ */
+void *calloc(size_t elements, size_t size) {
+  void *bp;
+  size_t asize = elements * size;
+
+  if (asize / elements != size) {
+    // Multiplication overflowed
+    return NULL;
+  }
+
+  bp = malloc(asize);
+  if (bp == NULL) {
+    return NULL;
+  }
+
+  // Initialize all bits to 0
+  memset(bp, 0, asize);
+
+  return bp;
+}
+
+/*
+ * mm_malloc_batch: to allocate n blocks of the same size in one call. The
+ * arena is locked once, cached blocks of the size are used first, and the
+ * rest are carved side by side out of as few free regions as possible.
+ * args:
+ * size_t size: the payload size of every block
+ * size_t n: the number of blocks
+ * void **out: where the n payload addresses are stored
+ * return: the number of blocks allocated; less than n if out of memory
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+  if (size == 0 || n == 0) {
+    return 0;
+  }
+  init_once();
+
+  arena_acquire();
+  size_t count = arena_malloc_batch(size, n, out);
+  arena_release();
+  return count;
+}
+
+/*
+ * mm_free_batch: to free n blocks in one call. The arena is locked once,
+ * the blocks are sorted by address, and every run of blocks that lie side
+ * by side is merged and coalesced as a single block. The array is
+ * reordered.
+ * args:
+ * void **ptrs: the payload addresses; NULL entries are skipped
+ * size_t n: the number of entries
+ * return: void
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+  size_t count = 0;
+
+  arena_acquire();
+  dbg_requires(mm_checkheap(__LINE__));
+
+  // Slab objects, mapped blocks and blocks of other threads are freed one
+  // by one; the others are kept at the front of the array
+  for (size_t i = 0; i < n; i++) {
+    void *bp = ptrs[i];
+    if (bp == NULL) {
+      continue;
+    }
+    block_t *block = payload_to_header(bp);
+    slab_t *slab = slab_of(bp);
+    if (slab == NULL && is_mapped(block)) {
+      unmap_block(block);
+      continue;
+    }
+#if MM_THREADS
+    arena_t *owner = arena_of(block);
+    if (owner != cur_arena) {
+      arena_remote_free(owner, block);
+      continue;
+    }
+#endif
+    if (slab != NULL) {
+      slab_free(slab, bp);
+      continue;
+    }
+    dbg_assert(get_alloc(block));
+#if !MM_THREADS
+    grow_freed += get_size(block);
+#endif
+    ptrs[count++] = bp;
+  }
+
+  qsort(ptrs, count, sizeof(void *), address_cmp);
+
+  for (size_t i = 0; i < count;) {
+    block_t *block = payload_to_header(ptrs[i]);
+    size_t size = get_size(block);
+    size_t j = i + 1;
+
+    // Absorb the blocks that follow right behind
+    while (j < count && payload_to_header(ptrs[j]) == (block_t *)((char *)block + size)) {
+      size += get_size(payload_to_header(ptrs[j]));
+      j += 1;
+    }
+
+    if (j == i + 1) {
+      recycle_block(block);
+    } else {
+      write_header(block, size, true, get_prev_alloc(block), get_prev_16B(block));
+      set_prev_16B(find_next(block), false);
+      free_block(block);
+    }
+    i = j;
+  }
+
+  dbg_ensures(mm_checkheap(__LINE__));
+  arena_release();
+}
+
+/*
+ * mm_arena_create: to create an empty user arena. Its objects cannot be
+ * passed to free or realloc; they all go away with mm_arena_reset or
+ * mm_arena_destroy. An arena must be used by one thread at a time.
+ * args: none
+ * return: the arena, or NULL if out of memory
+ */
+mm_arena_t *mm_arena_create(void) {
+  mm_arena_t *arena = malloc(sizeof(mm_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->chunk_size = bump_chunk_min;
+  return arena;
+}
+
+/*
+ * mm_arena_malloc: to allocate an object from a user arena by bumping a
+ * pointer through its newest chunk.
+ * args:
+ * mm_arena_t *arena: the arena
+ * size_t size: the size of input
+ * return: a 16-byte aligned object, or NULL if size is 0 or out of memory
+ */
+void *mm_arena_malloc(mm_arena_t *arena, size_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+
+  size_t asize = round_up(size, dsize);
+  if (asize > (size_t)(arena->end - arena->next)) {
+    // An object larger than a quarter of a chunk gets a chunk of its own,
+    // so that the space left in the newest chunk is not wasted
+    if (asize > (arena->chunk_size - bump_offset) / 4) {
+      return bump_chunk(arena, asize);
+    }
+
+    char *bp = bump_chunk(arena, arena->chunk_size - bump_offset);
+    if (bp == NULL) {
+      return NULL;
+    }
+    arena->next = bp;
+    arena->end = bp + arena->chunk_size - bump_offset;
+
+    // Each chunk is twice the size of the last, up to bump_chunk_max
+    if (arena->chunk_size < bump_chunk_max) {
+      arena->chunk_size = 2 * (arena->chunk_size + wsize) - wsize;
+    }
+  }
+
+  void *bp = arena->next;
+  arena->next += asize;
+  return bp;
+}
+
+/*
+ * mm_arena_reset: to free all objects of a user arena at once. The
+ * chunks go back to the free lists; the arena can be used again.
+ * args:
+ * mm_arena_t *arena: the arena
+ * return: void
+ */
+void mm_arena_reset(mm_arena_t *arena) {
+  void *chunk = arena->chunks;
+  while (chunk != NULL) {
+    void *next = get(chunk);
+    free(chunk);
+    chunk = next;
+  }
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->chunk_size = bump_chunk_min;
+}
+
+/*
+ * mm_arena_destroy: to free all objects of a user arena and the arena.
+ * args:
+ * mm_arena_t *arena: the arena, or NULL
+ * return: void
+ */
+void mm_arena_destroy(mm_arena_t *arena) {
+  if (arena == NULL) {
+    return;
+  }
+  mm_arena_reset(arena);
+  free(arena);
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * arena_malloc_batch: mm_malloc_batch on the locked arena of the calling
+ * thread.
+ * args:
+ * size_t size: the payload size of every block, not 0
+ * size_t n: the number of blocks
+ * void **out: where the payload addresses are stored
+ * return: the number of blocks allocated
+ */
+static size_t arena_malloc_batch(size_t size, size_t n, void **out) {
+  dbg_requires(mm_checkheap(__LINE__));
+
+  size_t asize = round_up(size + wsize, dsize);
+  size_t count = 0;
+
+  // Slab objects and blocks that may be mapped are taken one at a time
+  if ((size <= slab_max_size && size % dsize > wsize) ||
+      asize >= __atomic_load_n(&map_threshold, __ATOMIC_RELAXED)) {
+    while (count < n && (out[count] = arena_malloc(size)) != NULL) {
+      count += 1;
+    }
+    return count;
+  }
+
+  block_t *block;
+  while (count < n && (block = tcache_get(asize)) != NULL) {
+    out[count++] = header_to_payload(block);
+  }
+
+  while (count < n) {
+    size_t want = n - count;
+    if (want > batch_max_size / asize) {
+      want = batch_max_size / asize;
+    }
+
+    // A region for all of them, else one that holds at least one
+    block = NULL;
+    if (want > 1) {
+      block = find_fit(want * asize);
+    }
+    if (block == NULL) {
+      block = find_fit(asize);
+    }
+    if (block == NULL && tcache_flush_all()) {
+      block = find_fit(want * asize);
+    }
+    if (block == NULL) {
+      block = extend_heap(heap_step(want * asize));
+      if (block == NULL) {
+        break;
+      }
+    }
+
+    size_t k = get_size(block) / asize;
+    if (k > want) {
+      k = want;
+    }
+    carve_blocks(block, asize, k, out + count);
+    count += k;
+  }
+
+  dbg_ensures(mm_checkheap(__LINE__));
+  return count;
+}
+
+/*
+ * carve_blocks: to allocate n blocks side by side from the front of a free
+ * block. The free block leaves its list once and the rest of it is put
+ * back once, however many blocks are carved.
+ * args:
+ * block_t *block: a free block of at least n * asize bytes
+ * size_t asize: the adjusted size of every block
+ * size_t n: the number of blocks, at least 1
+ * void **out: where the payload addresses are stored
+ * return: the last block carved
+ */
+static block_t *carve_blocks(block_t *block, size_t asize, size_t n, void **out) {
+  dbg_requires(!get_alloc(block) && get_size(block) >= n * asize);
+
+  size_t block_size = get_size(block);
+
+  // Allocate the whole run as one block first, which splits off the rest
+  write_header(block, block_size, true, true, get_prev_16B(block));
+  split_block(block, n * asize, block_size);
+  size_t run_size = get_size(block);
+
+  // then cut the run into n blocks; the last one takes any slack
+  for (size_t i = 0; i < n; i++) {
+    size_t size = (i == n - 1) ? run_size - (n - 1) * asize : asize;
+    if (i > 0) {
+      write_header(block, size, true, true, asize == dsize);
+    } else {
+      write_header(block, size, true, get_prev_alloc(block), get_prev_16B(block));
+    }
+    out[i] = header_to_payload(block);
+    if (i < n - 1) {
+      block = find_next(block);
+    }
+  }
+  set_prev_16B(find_next(block), get_size(block) == dsize);
+  return block;
+}
+
+/*
+ * address_cmp: ascending order of payload addresses, for qsort.
+ * args:
+ * const void *a, const void *b: pointers to two entries of a void * array
+ * return: negative, zero or positive
+ */
+static int address_cmp(const void *a, const void *b) {
+  word_t x = (word_t)*(void *const *)a;
+  word_t y = (word_t)*(void *const *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * bump_chunk: to add a chunk to a user arena.
+ * args:
+ * mm_arena_t *arena: the arena
+ * size_t size: the bytes of objects the chunk holds
+ * return: the first object of the chunk, or NULL if out of memory
+ */
+static void *bump_chunk(mm_arena_t *arena, size_t size) {
+  void *chunk = malloc(size + bump_offset);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  put(chunk, (word_t)arena->chunks);
+  arena->chunks = chunk;
+  return (char *)chunk + bump_offset;
+}
+
+/*
+ * extend_heap: to extend the heap size when the heap is initialized or there is no block fit.
+ * args:
+ * size_t size: the size to extend
+ * return:
+ * a block_t pointer pointed to the extended block (after coalescing)
+ */
+static block_t *extend_heap(size_t size) {
+  void *bp;
+
+  // Allocate an even number of words to maintain alignment
+  size = round_up(size, dsize);
+#if MM_THREADS
+  bp = arena_sbrk(size, NULL);
+#else
+  bp = grow_heap(size);
+#endif
+  if (bp == (void *)-1) {
+    return NULL;
+  }
+
+  // Initialize free block header/footer
+  block_t *block = payload_to_header(bp);
+
+  //check if the prev block is allocated
+  bool prev_alloc = get_prev_alloc(block);
+
+  bool prev_16B = get_prev_16B(block);
 
   // if the prev block is epilogue block then prev_alloc is true
   if (!prev_16B && extract_size(*((word_t *)block - 1)) == 0) {
@@ -470,7 +1594,7 @@ static block_t *coalesce_block(block_t *block) {
   if (prev_alloc && next_alloc) // Case 1
   {
     // insert the new free block into the seglist.
- 	  insert_node(root_list, block);
+ 	  insert_node(cur_arena->root_list, block);
     set_prev_alloc(block_next, false);
   }
 
@@ -478,10 +1602,10 @@ static block_t *coalesce_block(block_t *block) {
   {
     size += get_size(block_next);
     
-    delete_node(root_list, block_next);
+    delete_node(cur_arena->root_list, block_next);
     write_header(block, size, false, true, get_prev_16B(block));
     write_footer(block, size, false, true, get_prev_16B(block));
-    insert_node(root_list, block);
+    insert_node(cur_arena->root_list, block);
     block_t *block_next_next = find_next(block);
     set_prev_16B(block_next_next, false);
   }
@@ -498,13 +1622,13 @@ static block_t *coalesce_block(block_t *block) {
 
     size += get_size(block_prev);
 
-    delete_node(root_list, block_prev);
+    delete_node(cur_arena->root_list, block_prev);
     write_header(block_prev, size, false, true, get_prev_16B(block_prev));
     write_footer(block_prev, size, false, true, get_prev_16B(block_prev));
     block = block_prev;
     set_prev_alloc(block_next, false);
     set_prev_16B(block_next, false);
-    insert_node(root_list, block);
+    insert_node(cur_arena->root_list, block);
   }
 
   else // Case 4
@@ -517,13 +1641,13 @@ static block_t *coalesce_block(block_t *block) {
     }
   	size += get_size(block_next) + get_size(block_prev); //size after coalescing both prev and next
   	// delete both prev and next from list
-  	delete_node(root_list, block_prev);
-    delete_node(root_list, block_next);
+  	delete_node(cur_arena->root_list, block_prev);
+    delete_node(cur_arena->root_list, block_next);
     //create the new block and insert to the list
     write_header(block_prev, size, false, true, get_prev_16B(block_prev));
     write_footer(block_prev, size, false, true, get_prev_16B(block_prev));
     block = block_prev;
-    insert_node(root_list, block);
+    insert_node(cur_arena->root_list, block);
     block_t *block_next_next = find_next(block);
     set_prev_16B(block_next_next, false);
   }
@@ -547,7 +1671,7 @@ static void split_block(block_t *block, size_t asize, size_t block_size) {
   if ((block_size - asize) >= dsize) {
     
     //delete the current block from list
-    delete_node(root_list, block);
+    delete_node(cur_arena->root_list, block);
     //write the header of an allocated block
     write_header(block, asize, true, true, get_prev_16B(block));
     
@@ -568,11 +1692,11 @@ static void split_block(block_t *block, size_t asize, size_t block_size) {
     } 
 
     //insert next block to the list
-    insert_node(root_list, block_next);
+    insert_node(cur_arena->root_list, block_next);
 
   } else {
   	//delete the current block from the list.
-    delete_node(root_list, block);
+    delete_node(cur_arena->root_list, block);
     write_header(block, block_size, true, true, get_prev_16B(block));
 
     //set the prev_alloc of the next block to be true.
@@ -583,13 +1707,145 @@ static void split_block(block_t *block, size_t asize, size_t block_size) {
   dbg_ensures(get_alloc(block));
 }
 
+/*
+ * shrink_block: to give the tail of an allocated block back to the free
+ * lists if it is large enough to be a block of its own.
+ * args:
+ * block_t *block: an allocated block
+ * size_t asize: the size the block is reduced to
+ * return: void
+ */
+static void shrink_block(block_t *block, size_t asize) {
+  dbg_requires(get_alloc(block));
+
+  size_t block_size = get_size(block);
+  if (block_size - asize < dsize) {
+    return;
+  }
+
+  write_header(block, asize, true, get_prev_alloc(block), get_prev_16B(block));
+
+  // the tail starts out as an allocated block and is then freed normally
+  block_t *rest = find_next(block);
+  size_t rest_size = block_size - asize;
+  write_header(rest, rest_size, true, true, asize == dsize);
+  set_prev_16B(find_next(rest), rest_size == dsize);
+  free_block(rest);
+}
+
+/*
+ * resize_block: to resize an allocated block without moving it. The block
+ * can always shrink; it grows by absorbing a free successor and, if it is
+ * the last block of the heap, by extending the heap behind it.
+ * args:
+ * block_t *block: an allocated block
+ * size_t asize: the adjusted block size wanted
+ * return: true if the block now has asize bytes, false if it must move.
+ */
+static bool resize_block(block_t *block, size_t asize) {
+  dbg_requires(get_alloc(block));
+
+  size_t block_size = get_size(block);
+  if (asize <= block_size) {
+    shrink_block(block, asize);
+    return true;
+  }
+
+  block_t *block_next = find_next(block);
+  size_t next_size = get_alloc(block_next) ? 0 : get_size(block_next);
+  block_t *after = (next_size != 0) ? find_next(block_next) : block_next;
+  bool at_tail = (get_size(after) == 0); // followed by the epilogue
+  size_t total = block_size + next_size;
+  size_t extra = 0;
+
+  if (total < asize) {
+    if (!at_tail) {
+      return false;
+    }
+    // grow the heap right behind the block; the old epilogue is reused
+    extra = asize - total;
+#if MM_THREADS
+    if (arena_sbrk(extra, (word_t *)after + 1) == (void *)-1) {
+      return false;
+    }
+#else
+    if (grow_heap(extra) == (void *)-1) {
+      return false;
+    }
+#endif
+    total += extra;
+  }
+
+  if (next_size != 0) {
+    delete_node(cur_arena->root_list, block_next);
+  }
+  write_header(block, total, true, get_prev_alloc(block), get_prev_16B(block));
+
+  block_next = find_next(block);
+  if (extra != 0) {
+    write_header(block_next, 0, true, true, false); // new epilogue
+  } else {
+    set_prev_alloc(block_next, true);
+    set_prev_16B(block_next, false);
+  }
+
+  shrink_block(block, asize);
+  return true;
+}
+
+#if TLSF
+/*
+ * find_fit: find a suitable block for a speicific size malloc (TLSF).
+ * The size is rounded up to the next list boundary, so the head of any
+ * non-empty list at or above it fits; the bitmaps find that list in O(1).
+ * size_t asize: the size to be malloc
+ * return block_t *: the block_t pointer pointed to a chosen block.
+ */
+static block_t *find_fit(size_t asize) {
+  if (asize == dsize && cur_arena->root_list[0] != NULL) {
+    return cur_arena->root_list[0];
+  }
+
+  // blocks in the TLSF lists are at least min_block_size bytes
+  size_t size = max(asize, min_block_size);
+  if (size >= tlsf_small_size) {
+    size += ((size_t)1 << (floor_log2(size) - SL_LOG2)) - 1;
+  }
+
+  int fl, sl;
+  tlsf_mapping(size, &fl, &sl);
+
+  // a larger list in the same class, or else the first list of a larger class
+  uint32_t sl_map = cur_arena->tlsf_sl_bitmap[fl] & (~(uint32_t)0 << sl);
+  if (sl_map == 0) {
+    uint64_t fl_map = cur_arena->tlsf_fl_bitmap & (~(uint64_t)0 << (fl + 1));
+    if (fl_map == 0) {
+      return NULL;
+    }
+    fl = __builtin_ctzll(fl_map);
+    sl_map = cur_arena->tlsf_sl_bitmap[fl];
+  }
+  sl = __builtin_ctz(sl_map);
+
+  return cur_arena->tlsf_list[fl][sl];
+}
+#else
 /*
  * find_fit: find a suitable block for a speicific size malloc.
+ * Large sizes get the best fit from the tree; smaller ones take the best of
+ * the first RANGE candidates in the lists, then the smallest tree block.
  * size_t asize: the size to be malloc
  * return block_t *: the block_t pointer pointed to a chosen block.
  */
 
 static block_t *find_fit(size_t asize) {
+#if SIZE_STATS
+  mm_size_stats[0][asize / dsize < MM_SIZE_STATS ? asize / dsize : MM_SIZE_STATS - 1] += 1;
+#endif
+  if (asize >= tree_min_size) {
+    return tree_find_fit(cur_arena->root_list[SIZE - 1], asize);
+  }
+
   block_t *chosen_blocks[RANGE];
   int i = 0;
   for (i = 0; i < RANGE; i++) {
@@ -599,14 +1855,17 @@ static block_t *find_fit(size_t asize) {
   block_t *block;
   i = 0;
   //combined fit
-  for (int n = listnumber; (n < SIZE) && (i < RANGE); n++) {
-    for (block = root_list[n]; (block != NULL) && (i < RANGE); block = get(next_linknode(header_to_payload(block)))) {
+  for (int n = listnumber; (n < SIZE - 1) && (i < RANGE); n++) {
+    for (block = cur_arena->root_list[n]; (block != NULL) && (i < RANGE); block = get(next_linknode(header_to_payload(block)))) {
       if (!(get_alloc(block)) && (asize <= get_size(block))) { 
         chosen_blocks[i] = block;
         i += 1;
       }
     }
   }
+  if (i < RANGE) {
+    chosen_blocks[i] = tree_find_fit(cur_arena->root_list[SIZE - 1], asize);
+  }
 
   block_t *best = chosen_blocks[0];
   if (best != NULL) {
@@ -621,6 +1880,7 @@ static block_t *find_fit(size_t asize) {
 
   return best; 
 }
+#endif
 
 
 
@@ -702,48 +1962,323 @@ static void set_prev_16B(block_t *block, bool prev_16B) {
 }
 
 /*
- * find the number to determine which list to choose.
- * args: 
+ * find_listnumber: find the list a free block size belongs to, from the
+ * table of sizeclass.h (generated by sizetune).
+ * args:
  * size_t size: the size of a block
  * return: the number of a chosen list
  * precondition: when insert or delete a block in the list.
  */
 static int find_listnumber(size_t size) {
-	int listnumber = 0;
+  if (size / dsize >= sizeof(size_class)) {
+    return SIZE - 1;
+  }
+  return size_class[size / dsize];
+}
+
+/*
+ * list_head: find the head pointer of the free list a block size belongs to.
+ * args:
+ * block_t *root_list[SIZE]: seglist
+ * size_t size: the size of a free block
+ * return: the address of the list head
+ */
+static block_t **list_head(block_t *root_list[SIZE], size_t size) {
+#if TLSF
   if (size == dsize) {
-    listnumber = 0;
-  } else if (size == dsize * 2) {
-		listnumber = 1;
-	} else if (size >= dsize * 3 && size <= dsize * 4) {
-		listnumber = 2;
-	} else if (size >= dsize * 5 && size <= dsize * 6) {
-		listnumber = 3;
-	} else if (size >= dsize * 7 && size <= dsize * 9) {
-		listnumber = 4;
-	} else if (size >= dsize * 10 && size <= dsize * 12) {
-		listnumber = 5;
-	} else if (size >= dsize * 13 && size <= dsize * 15) {
-		listnumber = 6;
-	} else if (size >= dsize * 16 && size <= dsize * 20) {
-		listnumber = 7;
-	} else if (size >= dsize * 21 && size <= dsize * 26) {
-		listnumber = 8;
-	} else if (size >= dsize * 27 && size <= dsize * 36) {
-		listnumber = 9;
-	} else if (size >= dsize * 37 && size <= dsize * 50) {
-    listnumber = 10;
-	} else if (size >= dsize * 51 && size <= dsize * 70) {
-    listnumber = 11;
-  } else if (size >= dsize * 71 && size <= dsize * 99) {
-    listnumber = 12;
-  } else if (size >= dsize * 100 && size <= dsize * 140) {
-    listnumber = 13;
-  } else if (size >= dsize * 141) {
-    listnumber = 14;
-  }
-	return listnumber;
+    return &root_list[0];
+  }
+  int fl, sl;
+  tlsf_mapping(size, &fl, &sl);
+  return &cur_arena->tlsf_list[fl][sl];
+#else
+  return &root_list[find_listnumber(size)];
+#endif
 }
 
+#if !TLSF
+/*
+ * The free blocks of list SIZE - 1 form a treap ordered by size and then
+ * address, rooted at root_list[SIZE - 1]. The links live in the payload:
+ * left child, right child and parent. The rotations follow stree.c, but a
+ * splay on every insert and remove cost more than the seglists it replaces,
+ * so the tree is kept balanced by a priority hashed from the block address
+ * (a parent never has a lower priority than its children) instead.
+ */
+
+/*
+ * tree_left: the address of the left child link of a tree block.
+ * args:
+ * block_t *node: a free block in the tree
+ * return: the address of the link
+ */
+static block_t **tree_left(block_t *node) {
+  return (block_t **)header_to_payload(node);
+}
+
+/*
+ * tree_right: the address of the right child link of a tree block.
+ * args:
+ * block_t *node: a free block in the tree
+ * return: the address of the link
+ */
+static block_t **tree_right(block_t *node) {
+  return (block_t **)header_to_payload(node) + 1;
+}
+
+/*
+ * tree_parent: the address of the parent link of a tree block.
+ * args:
+ * block_t *node: a free block in the tree
+ * return: the address of the link
+ */
+static block_t **tree_parent(block_t *node) {
+  return (block_t **)header_to_payload(node) + 2;
+}
+
+/*
+ * tree_less: the tree order, by size and then by address.
+ * args:
+ * block_t *a, *b: two free blocks
+ * return: true if a comes before b
+ */
+static bool tree_less(block_t *a, block_t *b) {
+  size_t a_size = get_size(a);
+  size_t b_size = get_size(b);
+  return a_size < b_size || (a_size == b_size && a < b);
+}
+
+/*
+ * tree_priority: the treap priority of a block, a hash of its address.
+ * args:
+ * block_t *node: a free block
+ * return: the priority
+ */
+static word_t tree_priority(block_t *node) {
+  return ((word_t)node >> 4) * 0x9E3779B97F4A7C15ull;
+}
+
+/*
+ * tree_rotate_left: to rotate x down to the left of its right child.
+ * args:
+ * block_t **root: the tree root
+ * block_t *x: a block with a right child
+ * return: void
+ */
+static void tree_rotate_left(block_t **root, block_t *x) {
+  block_t *y = *tree_right(x);
+  block_t *parent = *tree_parent(x);
+
+  *tree_right(x) = *tree_left(y);
+  if (*tree_left(y) != NULL) {
+    *tree_parent(*tree_left(y)) = x;
+  }
+  *tree_parent(y) = parent;
+  if (parent == NULL) {
+    *root = y;
+  } else if (*tree_left(parent) == x) {
+    *tree_left(parent) = y;
+  } else {
+    *tree_right(parent) = y;
+  }
+  *tree_left(y) = x;
+  *tree_parent(x) = y;
+}
+
+/*
+ * tree_rotate_right: to rotate x down to the right of its left child.
+ * args:
+ * block_t **root: the tree root
+ * block_t *x: a block with a left child
+ * return: void
+ */
+static void tree_rotate_right(block_t **root, block_t *x) {
+  block_t *y = *tree_left(x);
+  block_t *parent = *tree_parent(x);
+
+  *tree_left(x) = *tree_right(y);
+  if (*tree_right(y) != NULL) {
+    *tree_parent(*tree_right(y)) = x;
+  }
+  *tree_parent(y) = parent;
+  if (parent == NULL) {
+    *root = y;
+  } else if (*tree_left(parent) == x) {
+    *tree_left(parent) = y;
+  } else {
+    *tree_right(parent) = y;
+  }
+  *tree_right(y) = x;
+  *tree_parent(x) = y;
+}
+
+/*
+ * tree_replace: to put the subtree v in the place of the subtree u.
+ * args:
+ * block_t **root: the tree root
+ * block_t *u: a block in the tree
+ * block_t *v: a block or NULL
+ * return: void
+ */
+static void tree_replace(block_t **root, block_t *u, block_t *v) {
+  block_t *parent = *tree_parent(u);
+  if (parent == NULL) {
+    *root = v;
+  } else if (*tree_left(parent) == u) {
+    *tree_left(parent) = v;
+  } else {
+    *tree_right(parent) = v;
+  }
+  if (v != NULL) {
+    *tree_parent(v) = parent;
+  }
+}
+
+/*
+ * tree_minimum: the first block of a subtree.
+ * args:
+ * block_t *node: the root of a non-empty subtree
+ * return: the smallest block in it
+ */
+static block_t *tree_minimum(block_t *node) {
+  while (*tree_left(node) != NULL) {
+    node = *tree_left(node);
+  }
+  return node;
+}
+
+/*
+ * tree_successor: the block after a block in the tree order.
+ * args:
+ * block_t *node: a block in the tree
+ * return: the next block, or NULL for the last one
+ */
+static block_t *tree_successor(block_t *node) {
+  if (*tree_right(node) != NULL) {
+    return tree_minimum(*tree_right(node));
+  }
+  block_t *parent = *tree_parent(node);
+  while (parent != NULL && *tree_right(parent) == node) {
+    node = parent;
+    parent = *tree_parent(node);
+  }
+  return parent;
+}
+
+/*
+ * tree_insert: to insert a free block into the tree.
+ * args:
+ * block_t **root: the tree root
+ * block_t *node: the free block
+ * return: void
+ */
+static void tree_insert(block_t **root, block_t *node) {
+  block_t *parent = NULL;
+  block_t *curr = *root;
+  while (curr != NULL) {
+    parent = curr;
+    curr = tree_less(node, curr) ? *tree_left(curr) : *tree_right(curr);
+  }
+
+  *tree_left(node) = NULL;
+  *tree_right(node) = NULL;
+  *tree_parent(node) = parent;
+  if (parent == NULL) {
+    *root = node;
+  } else if (tree_less(node, parent)) {
+    *tree_left(parent) = node;
+  } else {
+    *tree_right(parent) = node;
+  }
+
+  // rotate the new leaf up while it outranks its parent
+  word_t priority = tree_priority(node);
+  while ((parent = *tree_parent(node)) != NULL && tree_priority(parent) < priority) {
+    if (*tree_left(parent) == node) {
+      tree_rotate_right(root, parent);
+    } else {
+      tree_rotate_left(root, parent);
+    }
+  }
+}
+
+/*
+ * tree_remove: to remove a free block from the tree.
+ * args:
+ * block_t **root: the tree root
+ * block_t *node: a block in the tree
+ * return: void
+ */
+static void tree_remove(block_t **root, block_t *node) {
+  block_t *left, *right;
+
+  // rotate the block down below its higher priority child until it has one
+  while ((left = *tree_left(node)) != NULL && (right = *tree_right(node)) != NULL) {
+    if (tree_priority(left) > tree_priority(right)) {
+      tree_rotate_right(root, node);
+    } else {
+      tree_rotate_left(root, node);
+    }
+  }
+  tree_replace(root, node, (left != NULL) ? left : *tree_right(node));
+}
+
+/*
+ * tree_find_fit: the best fit in the tree, the lowest addressed of the
+ * smallest blocks of at least asize bytes.
+ * args:
+ * block_t *root: the tree root
+ * size_t asize: the size to be malloc
+ * return: the block, or NULL if no block is large enough
+ */
+static block_t *tree_find_fit(block_t *root, size_t asize) {
+  block_t *best = NULL;
+  block_t *curr = root;
+  while (curr != NULL) {
+    if (get_size(curr) >= asize) {
+      best = curr;
+      curr = *tree_left(curr);
+    } else {
+      curr = *tree_right(curr);
+    }
+  }
+  return best;
+}
+#endif
+
+#if TLSF
+/*
+ * floor_log2: the index of the highest set bit.
+ * args:
+ * size_t x: a non-zero value
+ * return: floor(log2(x))
+ */
+static int floor_log2(size_t x) {
+  return 63 - __builtin_clzll(x);
+}
+
+/*
+ * tlsf_mapping: find the TLSF list of a free block size. Sizes below
+ * tlsf_small_size are split into 16-byte steps; larger ones into SL_COUNT
+ * equal steps per power of two.
+ * args:
+ * size_t size: the size of a free block
+ * int *fl: set to the first-level class
+ * int *sl: set to the second-level list within the class
+ * return: void
+ */
+static void tlsf_mapping(size_t size, int *fl, int *sl) {
+  if (size < tlsf_small_size) {
+    *fl = 0;
+    *sl = (int)(size / dsize);
+  } else {
+    int log = floor_log2(size);
+    *fl = log - (SL_LOG2 + 4) + 1;
+    *sl = (int)(size >> (log - SL_LOG2)) - SL_COUNT;
+  }
+}
+#endif
+
 /*
  * to insert a block in the seglist
  * args: 
@@ -754,16 +2289,26 @@ static int find_listnumber(size_t size) {
 static void insert_node(block_t *root_list[SIZE], block_t *node) {
 	
   size_t node_size = get_size(node);
-	int listnumber = find_listnumber(node_size);
+  block_t **head = list_head(root_list, node_size);
+#if SIZE_STATS
+  mm_size_stats[1][node_size / dsize < MM_SIZE_STATS ? node_size / dsize : MM_SIZE_STATS - 1] += 1;
+#endif
+
+#if !TLSF
+  if (node_size >= tree_min_size) {
+    tree_insert(head, node);
+    return;
+  }
+#endif
   
-  block_t *old_head = root_list[listnumber];
+  block_t *old_head = *head;
   if (old_head == node) {
     return;
   }
 
   // 16B block only have next pointer
-  if (listnumber == 0) {
-    root_list[listnumber] = node;
+  if (node_size == dsize) {
+    *head = node;
     put(next_linknode(header_to_payload(node)), (word_t)old_head);
     return;
   }
@@ -772,9 +2317,15 @@ static void insert_node(block_t *root_list[SIZE], block_t *node) {
 	if (old_head != NULL) {
 		put(prev_linknode(header_to_payload(old_head)), (word_t)node);
 	}
-	root_list[listnumber] = node;
+	*head = node;
 	put(prev_linknode(header_to_payload(node)), 0);
 
+#if TLSF
+  int fl, sl;
+  tlsf_mapping(node_size, &fl, &sl);
+  cur_arena->tlsf_fl_bitmap |= (uint64_t)1 << fl;
+  cur_arena->tlsf_sl_bitmap[fl] |= (uint32_t)1 << sl;
+#endif
 }
 
 /*
@@ -786,10 +2337,17 @@ static void insert_node(block_t *root_list[SIZE], block_t *node) {
  */
 static void delete_node(block_t *root_list[SIZE], block_t *node) {
 	size_t node_size = get_size(node);
-	int listnumber = find_listnumber(node_size);
+  block_t **head = list_head(root_list, node_size);
+
+#if !TLSF
+  if (node_size >= tree_min_size) {
+    tree_remove(head, node);
+    return;
+  }
+#endif
 
   // for 16B block: no prev pointer, get along the list to find the block to be deleted.
-  if (listnumber == 0) {
+  if (node_size == dsize) {
     if (root_list[0] == node) {
       root_list[0] = get(next_linknode(header_to_payload(node)));
       return;
@@ -809,12 +2367,23 @@ static void delete_node(block_t *root_list[SIZE], block_t *node) {
     }
   } else {
     // if the block is the root block
-    if (root_list[listnumber] == node) {
+    if (*head == node) {
       block_t *node_next = get(next_linknode(header_to_payload(node)));
-      root_list[listnumber] = node_next;
+      *head = node_next;
       if (node_next != NULL) {
         put(prev_linknode(header_to_payload(node_next)), 0);
       }
+#if TLSF
+      // the list is empty now
+      if (node_next == NULL) {
+        int fl, sl;
+        tlsf_mapping(node_size, &fl, &sl);
+        cur_arena->tlsf_sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+        if (cur_arena->tlsf_sl_bitmap[fl] == 0) {
+          cur_arena->tlsf_fl_bitmap &= ~((uint64_t)1 << fl);
+        }
+      }
+#endif
 
     } else {
       block_t *node_prev = get(prev_linknode(header_to_payload(node)));
@@ -829,84 +2398,568 @@ static void delete_node(block_t *root_list[SIZE], block_t *node) {
 }
 
 /*
- * The heap checker scans the heap and checks it for possible errors 
+ * tcache_index: to find the tcache bin of a block size.
  * args:
- * int line: the number of line calling this function.
+ * size_t size: the block size, a multiple of 16
+ * return: the bin number, TCACHE_BINS for blocks above tcache_max_size
+ */
+static int tcache_index(size_t size) {
+  if (size > tcache_max_size) {
+    return TCACHE_BINS;
+  }
+  return (int)(size / dsize) - 1;
+}
+
+/*
+ * tcache_put: to cache a freed block in the bin of its size (LIFO).
+ * The block keeps its allocated header; the bin link lives in the payload.
+ * If the bin gets too long, its older half goes back to the seglists; with
+ * DEFER_COALESCE all bins go back once they hold too many bytes.
+ * args:
+ * block_t *block: the block being freed
+ * return: void
+ */
+static void tcache_put(block_t *block) {
+  int index = tcache_index(get_size(block));
+
+  put(next_linknode(header_to_payload(block)), (word_t)cur_arena->tcache[index]);
+  cur_arena->tcache[index] = block;
+  cur_arena->tcache_count[index] += 1;
+
+#if DEFER_COALESCE
+  cur_arena->tcache_bytes += get_size(block);
+  if (cur_arena->tcache_bytes > DEFER_LIMIT) {
+    tcache_flush_all();
+  }
+#else
+  if (cur_arena->tcache_count[index] > tcache_limit) {
+    tcache_flush(index, tcache_limit / 2);
+  }
+#endif
+}
+
+/*
+ * tcache_get: to take the most recently cached block of a size. In the
+ * bin of larger blocks only the most recent one is looked at.
+ * args:
+ * size_t asize: the adjusted block size
+ * return: an allocated block of exactly asize bytes, or NULL
+ */
+static block_t *tcache_get(size_t asize) {
+  int index = tcache_index(asize);
+  if (index >= TCACHE_LISTS) {
+    return NULL;
+  }
+
+  block_t *block = cur_arena->tcache[index];
+  if (block == NULL || get_size(block) != asize) {
+    return NULL;
+  }
+  cur_arena->tcache[index] = get(next_linknode(header_to_payload(block)));
+  cur_arena->tcache_count[index] -= 1;
+#if DEFER_COALESCE
+  cur_arena->tcache_bytes -= asize;
+#endif
+  return block;
+}
+
+/*
+ * tcache_flush: to free all but the first keep blocks of a bin.
+ * args:
+ * int index: the bin number
+ * int keep: how many of the most recent blocks stay cached
+ * return: void
+ */
+static void tcache_flush(int index, int keep) {
+  block_t *block = cur_arena->tcache[index];
+  block_t **link = &cur_arena->tcache[index];
+  int n = 0;
+
+  while (block != NULL && n < keep) {
+    link = (block_t **)next_linknode(header_to_payload(block));
+    block = *link;
+    n += 1;
+  }
+  *link = NULL;
+  cur_arena->tcache_count[index] = n;
+
+  while (block != NULL) {
+    block_t *next = get(next_linknode(header_to_payload(block)));
+#if DEFER_COALESCE
+    cur_arena->tcache_bytes -= get_size(block);
+#endif
+    free_block(block);
+    block = next;
+  }
+}
+
+/*
+ * tcache_flush_all: to empty every tcache bin into the seglists.
+ * args: none
+ * return: true if any block was flushed
+ */
+static bool tcache_flush_all(void) {
+  bool flushed = false;
+  for (int i = 0; i < TCACHE_LISTS; i++) {
+    if (cur_arena->tcache[i] != NULL) {
+      tcache_flush(i, 0);
+      flushed = true;
+    }
+  }
+  return flushed;
+}
+
+/*
+ * slab_of: to find the slab a payload lies in.
+ * args:
+ * void *bp: a payload address
+ * return: the slab, or NULL if bp is the payload of a block
+ */
+static slab_t *slab_of(void *bp) {
+  // the heap starts one word before heap_start, on a page boundary and so
+  // on a slab boundary
+  word_t n = ((word_t)bp - (word_t)heap_start + wsize) >> SLAB_LOG2;
+  if (n >= SLAB_MAP_SIZE ||
+      !(__atomic_load_n(&slab_map[n / 64], __ATOMIC_RELAXED) & ((word_t)1 << (n % 64)))) {
+    return NULL;
+  }
+  return (slab_t *)((word_t)bp & ~(word_t)(slab_size - 1));
+}
+
+/*
+ * slab_first: returns the first object slot of a slab, after its header.
+ */
+static size_t slab_first(size_t size) {
+  return round_up(sizeof(slab_t), size) / size;
+}
+
+/*
+ * slab_last: returns the slot past the last object of a slab; the last
+ * word of the slab is the header of the next block.
+ */
+static size_t slab_last(size_t size) {
+  return (slab_size - wsize) / size;
+}
+
+/*
+ * slab_malloc: to take a free object from the first slab of its class
+ * that has one, starting a new slab if none has.
+ * args:
+ * size_t size: the requested size, at most slab_max_size
+ * return: the object, or NULL if no slab could be started
+ */
+static void *slab_malloc(size_t size) {
+  int index = (int)((size - 1) / dsize);
+  slab_t *slab = cur_arena->slabs[index];
+
+  if (slab == NULL && (slab = slab_new(index)) == NULL) {
+    return NULL;
+  }
+
+  // a listed slab always has a clear bit
+  int w = 0;
+  while (~slab->bitmap[w] == 0) {
+    w++;
+  }
+  int bit = __builtin_ctzll(~slab->bitmap[w]);
+  slab->bitmap[w] |= (word_t)1 << bit;
+  slab->used += 1;
+  if (slab->used == slab->capacity) {
+    slab_unlink(slab);
+  }
+  return (char *)slab + ((size_t)(w * 64 + bit) << slab->shift);
+}
+
+/*
+ * slab_new: to start a slab of a class. The heap block of a slab must
+ * fill an aligned slab-sized piece of the heap exactly, so a block of twice
+ * the slab size is allocated and what lies before and after the piece in
+ * it is freed again.
+ * args:
+ * int index: the slab class
+ * return: the new slab, on the list of its class, or NULL
+ */
+static slab_t *slab_new(int index) {
+  char *bp = arena_malloc(2 * slab_size - wsize);
+  if (bp == NULL) {
+    return NULL;
+  }
+
+  block_t *block = payload_to_header(bp);
+  char *start = (char *)round_up((word_t)bp, slab_size);
+  word_t n = ((word_t)start - (word_t)mem_heap_lo()) / slab_size;
+  if (n >= SLAB_MAP_SIZE) {
+    free_block(block);
+    return NULL;
+  }
+
+  if (start != bp) {
+    size_t block_size = get_size(block);
+    size_t lead = start - bp;
+    write_header(block, lead, true, get_prev_alloc(block), get_prev_16B(block));
+    write_header(payload_to_header(start), block_size - lead, true, true, lead == dsize);
+    free_block(block);
+    block = payload_to_header(start);
+  }
+  shrink_block(block, slab_size);
+
+  slab_t *slab = (slab_t *)start;
+  size_t size = (size_t)(index + 1) * dsize;
+  size_t first = slab_first(size), last = slab_last(size);
+  slab->size = size;
+  slab->shift = __builtin_ctzll(size);
+  slab->used = 0;
+  slab->capacity = last - first;
+  for (int w = 0; w < SLAB_BITMAP; w++) {
+    slab->bitmap[w] = 0;
+  }
+  for (size_t i = 0; i < SLAB_BITMAP * 64; i++) {
+    if (i < first || i >= last) {
+      slab->bitmap[i / 64] |= (word_t)1 << (i % 64);
+    }
+  }
+  slab_link(slab);
+  __atomic_fetch_or(&slab_map[n / 64], (word_t)1 << (n % 64), __ATOMIC_RELAXED);
+  return slab;
+}
+
+/*
+ * slab_free: to give an object back to its slab. A slab that was full
+ * is listed again; one that is empty is freed unless it is the only
+ * slab of its class with room, which is kept until the heap would grow.
+ * args:
+ * slab_t *slab: the slab of the object
+ * void *bp: the object
+ * return: void
+ */
+static void slab_free(slab_t *slab, void *bp) {
+  size_t slot = ((char *)bp - (char *)slab) >> slab->shift;
+  dbg_assert(slab->bitmap[slot / 64] & ((word_t)1 << (slot % 64)));
+
+  bool was_full = slab->used == slab->capacity;
+  slab->bitmap[slot / 64] &= ~((word_t)1 << (slot % 64));
+  slab->used -= 1;
+
+  if (was_full) {
+    slab_link(slab);
+  } else if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL)) {
+    slab_release(slab);
+  }
+}
+
+/*
+ * slab_release: to free the block of an empty slab.
+ * args:
+ * slab_t *slab: an empty slab on the list of its class
+ * return: void
+ */
+static void slab_release(slab_t *slab) {
+  word_t n = ((word_t)slab - (word_t)mem_heap_lo()) >> SLAB_LOG2;
+  slab_unlink(slab);
+  __atomic_fetch_and(&slab_map[n / 64], ~((word_t)1 << (n % 64)), __ATOMIC_RELAXED);
+  free_block(payload_to_header(slab));
+}
+
+/*
+ * slab_flush_all: to free the empty slab each class may keep. Such a
+ * slab is always alone on its list.
+ * args: none
+ * return: true if any slab was freed
+ */
+static bool slab_flush_all(void) {
+  bool flushed = false;
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    slab_t *slab = cur_arena->slabs[i];
+    if (slab != NULL && slab->used == 0) {
+      slab_release(slab);
+      flushed = true;
+    }
+  }
+  return flushed;
+}
+
+/*
+ * slab_link: to push a slab on the list of its class.
+ */
+static void slab_link(slab_t *slab) {
+  slab_t **head = &cur_arena->slabs[slab->size / dsize - 1];
+  slab->prev = NULL;
+  slab->next = *head;
+  if (*head != NULL) {
+    (*head)->prev = slab;
+  }
+  *head = slab;
+}
+
+/*
+ * slab_unlink: to take a slab off the list of its class.
+ */
+static void slab_unlink(slab_t *slab) {
+  if (slab->prev != NULL) {
+    slab->prev->next = slab->next;
+  } else {
+    cur_arena->slabs[slab->size / dsize - 1] = slab->next;
+  }
+  if (slab->next != NULL) {
+    slab->next->prev = slab->prev;
+  }
+}
+
+/*
+ * arena_of: to find the arena that owns a block.
+ * args:
+ * block_t *block: an allocated block
+ * return: the owning arena
+ */
+static arena_t *arena_of(block_t *block) {
+#if MM_THREADS
+  size_t chunk = ((word_t)block - (word_t)mem_heap_lo()) / chunksize;
+  return &arenas[arena_map[chunk] - 1];
+#else
+  return &arenas[0];
+#endif
+}
+
+/*
+ * arena_acquire: to lock the arena of the calling thread before using its
+ * lists. A thread is assigned an arena on its first call, and blocks that
+ * other threads freed meanwhile are given back to the arena here.
+ * args: none
+ * return: void
+ */
+static void arena_acquire(void) {
+#if MM_THREADS
+  if (cur_arena == NULL) {
+    unsigned int n = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+    cur_arena = &arenas[n % ARENA_COUNT];
+  }
+  pthread_mutex_lock(&cur_arena->lock);
+  if (__atomic_load_n(&cur_arena->remote_free, __ATOMIC_RELAXED) != NULL) {
+    arena_drain();
+  }
+#endif
+}
+
+/*
+ * arena_release: to unlock the arena of the calling thread.
+ * args: none
+ * return: void
+ */
+static void arena_release(void) {
+#if MM_THREADS
+  pthread_mutex_unlock(&cur_arena->lock);
+#endif
+}
+
+#if MM_THREADS
+/*
+ * arena_remote_free: to queue a block for the arena that owns it. The block
+ * stays marked allocated until the owner drains the queue, so its
+ * neighbours never coalesce with it meanwhile.
+ * args:
+ * arena_t *owner: the arena of the block
+ * block_t *block: the block being freed by another thread
+ * return: void
+ */
+static void arena_remote_free(arena_t *owner, block_t *block) {
+  block_t **link = (block_t **)next_linknode(header_to_payload(block));
+  block_t *head = __atomic_load_n(&owner->remote_free, __ATOMIC_RELAXED);
+  do {
+    *link = head;
+  } while (!__atomic_compare_exchange_n(&owner->remote_free, &head, block, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * arena_drain: to free the blocks other threads queued for this arena.
+ * The whole queue is taken at once, so the lock-free pushes never race
+ * with a pop.
+ * args: none
+ * return: void
+ */
+static void arena_drain(void) {
+  block_t *block = __atomic_exchange_n(&cur_arena->remote_free, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL) {
+    block_t *next = get(next_linknode(header_to_payload(block)));
+    recycle_block(block);
+    block = next;
+  }
+}
+
+/*
+ * arena_sbrk: mem_sbrk for the arena of the calling thread. If the heap
+ * ends with a segment of this arena, the bytes are appended to it.
+ * Otherwise a new segment starts at the next chunk boundary with its own
+ * prologue and a placeholder epilogue, so blocks never coalesce across
+ * arenas and each chunk has a single owner in arena_map.
+ * args:
+ * size_t size: the number of bytes to add behind the epilogue
+ * void *end: if not NULL, fail unless the heap currently ends here
+ * return: the address just past the epilogue to be replaced, or (void *)-1
+ */
+static void *arena_sbrk(size_t size, void *end) {
+  unsigned char owner = (unsigned char)(cur_arena - arenas + 1);
+  unsigned char *lo = mem_heap_lo();
+  void *bp = (void *)-1;
+
+  pthread_mutex_lock(&sbrk_lock);
+  size_t brk = mem_heapsize();
+  size_t start = brk;
+  if (end != NULL && (void *)(lo + brk) != end) {
+    pthread_mutex_unlock(&sbrk_lock);
+    return bp;
+  }
+  if (arena_map[(brk - 1) / chunksize] != owner) {
+    // the rest of the last chunk is left to its owner
+    start = round_up(brk, chunksize) + 2 * wsize;
+  }
+
+  if (start + size <= (size_t)ARENA_MAP_SIZE * chunksize &&
+      mem_sbrk(start + size - brk) != (void *)-1) {
+    for (size_t c = round_up(brk, chunksize) / chunksize; c * chunksize < start + size; c++) {
+      arena_map[c] = owner;
+    }
+    if (start != brk) {
+      word_t *prologue = (word_t *)(lo + start) - 2;
+      prologue[0] = pack(0, true, true, false);
+      prologue[1] = pack(0, true, true, false);
+    }
+    bp = lo + start;
+  }
+  pthread_mutex_unlock(&sbrk_lock);
+  return bp;
+}
+#endif
+
+/*
+ * check_list: to check one free list (not the 16B list) for the heap checker.
+ * args:
+ * int line: the number of line calling the heap checker.
+ * block_t **head: the head of the list
+ * size_t *count: incremented by the number of heap blocks in the list
  * return: true if no error, false otherwise.
  */
-bool mm_checkheap(int line) {
-   /*
-    * - Checking the heap (implicit list, explicit list, segregated list):
-	∗ 1. Check epilogue and prologue blocks.
-	∗ 2. Check each block’s address alignment.
-	∗ 3. Check heap boundaries.
-	∗ 4. Check each block’s header and footer: size (minimum size), previous/next allocate/free bit
-	* consistency, header and footer matching each other.
-	∗ 5. Check coalescing: no two consecutive free blocks in the heap.
-	* 
-	* – Checking the free list (explicit list, segregated list):
-	∗ 1. All next/previous pointers are consistent (if A’s next pointer points to B, B’s previous
-	* pointer should point to A).
-	∗ 2. All free list pointers are between mem heap lo() and mem heap high().
-	∗ 3. Count free blocks by iterating through every block and traversing free list by pointers and
-	* see if they match.
-	∗ 4. All blocks in each list bucket fall within bucket size range (segregated list)
-	*/
+static bool check_list(int line, block_t **head, size_t *count) {
+  block_t *root = *head;
+  block_t *block;
 
-	if (line == 0) {
-		return true;
-	}
-	  
-	// check epilogue block
-	word_t *ep_block = (word_t *)mem_heap_lo();
-	if (ep_block == NULL) {
-		printf("line %d: The epilogue block is null.\n", line);
-		return false;
-	} else {
-		size_t size = extract_size(*ep_block);
-		if (size != 0) {
-			printf("line %d: The size of the epilogue block is not 0.\n", line);
-			return false;
-		}
-		bool alloc = extract_alloc(*ep_block);
-		if (!alloc) {
-			printf("line %d: the epilogue block is not allocated.\n", line);
-			return false;
-		}
-	}
+  if (root == NULL) {
+    return true;
+  }
+
+  //check if the prev pointer of root block is null.
+  if (get(prev_linknode(header_to_payload(root))) != 0) {
+    printf("line %d: the prev pointer of the root block 0x%lx is not NULL.\n", line, (unsigned long)root);
+    return false;
+  }
+  for (block = root; block != NULL; block = get(next_linknode(header_to_payload(block)))) {
+    if ((word_t)block >= (word_t)heap_start) {
+      *count += 1;
+    }
+
+    //check if all blocks in each list bucket fall within bucket size range
+    if (list_head(cur_arena->root_list, get_size(block)) != head) {
+      printf("line %d: the size of the block does not belong in its list.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
+
+    //check if all the block in the list is free.
+    if (get_alloc(block)) {
+      printf("line: %d: An allocated block in the free list.", line);
+      printf(" The block is 0x%lx\n", (unsigned long) block);
+      return false;
+    }
+  }
+  return true;
+}
+
+#if !TLSF
+/*
+ * check_tree: to check the tree of large free blocks for the heap checker.
+ * Walks the tree in order, so it also checks that the order is strict.
+ * args:
+ * int line: the number of line calling the heap checker.
+ * block_t **root: the tree root
+ * size_t *count: incremented by the number of blocks in the tree
+ * return: true if no error, false otherwise.
+ */
+static bool check_tree(int line, block_t **root, size_t *count) {
+  block_t *prev = NULL;
+  block_t *block;
+
+  if (*root == NULL) {
+    return true;
+  }
+  if (*tree_parent(*root) != NULL) {
+    printf("line %d: the parent of the tree root 0x%lx is not NULL.\n", line, (unsigned long)*root);
+    return false;
+  }
+
+  for (block = tree_minimum(*root); block != NULL; block = tree_successor(block)) {
+    *count += 1;
+
+    if ((word_t)block < (word_t)heap_start || (word_t)block >= (word_t)mem_heap_hi()) {
+      printf("line %d: A tree block is outside the heap boundaries.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
+    if (get_alloc(block) || get_size(block) < tree_min_size) {
+      printf("line %d: An allocated or small block in the tree.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
+
+    // children must point back to their parent and not outrank it
+    block_t *left = *tree_left(block);
+    block_t *right = *tree_right(block);
+    if ((left != NULL && *tree_parent(left) != block) || (right != NULL && *tree_parent(right) != block)) {
+      printf("line %d: the parent pointer of a child does not point to this block.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
+    if ((left != NULL && tree_priority(left) > tree_priority(block)) || (right != NULL && tree_priority(right) > tree_priority(block))) {
+      printf("line %d: a child has a higher priority than its parent.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
 
-	// check prologue block
-	word_t *pi_block = (word_t *)(mem_heap_hi() - 7);
-	if (pi_block == NULL) {
-		printf("line %d: The prologue block is null.\n", line);
-		return false;
-	} else {
-		size_t size = extract_size(*pi_block);
-		if (size != 0) {
-			printf("line %d: The size of the prologue block is not 0.\n", line);
-			return false;
-		}
-		bool alloc = extract_alloc(*pi_block);
-		if (!alloc) {
-			printf("line %d: the prologue block is not allocated.\n", line);
-			return false;
-		}
-	}
+    if (prev != NULL && !tree_less(prev, block)) {
+      printf("line %d: the tree is out of order.", line);
+      printf(" The block is 0x%lx\n", (unsigned long)block);
+      return false;
+    }
+    prev = block;
+  }
+  return true;
+}
+#endif
 
+/*
+ * check_blocks: to check the blocks of one segment for the heap checker,
+ * from its first block up to the epilogue.
+ * args:
+ * int line: the number of line calling the heap checker.
+ * block_t *first: the first block of the segment
+ * size_t *free_count: incremented by the number of free blocks
+ * size_t *size: set to the total size of the blocks
+ * return: true if no error, false otherwise.
+ */
+static bool check_blocks(int line, block_t *first, size_t *free_count, size_t *size) {
+	word_t *ep_block = (word_t *)mem_heap_lo();
+	word_t *pi_block = (word_t *)(mem_heap_hi() - 7);
 	block_t *block;
-	size_t size = 0;
-	size_t free_count = 0;
 
-	//iterate through every block in the heap.
-	for (block = heap_start; block != (block_t *)pi_block; block = find_next(block)) {
+	*size = 0;
+	for (block = first; get_size(block) != 0; block = find_next(block)) {
 		// check block address alignment.
-		block_t *cal_address = (block_t *)((void *)heap_start + size);
+		block_t *cal_address = (block_t *)((void *)first + *size);
 		if (cal_address != block) {
 			printf("line %d: the block address alignment is wrong. ", line);
 			printf("The address should be 0x%lx, but the actual block address is 0x%lx.\n", (unsigned long)cal_address, (unsigned long)block);
 			return false;
 		}
-		size += get_size(block);
+		*size += get_size(block);
 
 		//check minimal block size
 		if (get_size(block) < dsize) {
@@ -924,8 +2977,7 @@ bool mm_checkheap(int line) {
 
 
 		//check heap boundaries
-    //printf("heap start: %lx, pi block: %lx\n", (unsigned long)heap_start, (unsigned long)pi_block);
-		if ((word_t)block < (word_t)heap_start || (word_t)block > (word_t)pi_block) {
+		if ((word_t)block < (word_t)first || (word_t)block > (word_t)pi_block) {
 			printf("line %d: The block address is outside the heap boundaries. ", line);
 			printf("The block is 0x%lx.\n", (unsigned long)block);
 			return false;
@@ -958,7 +3010,13 @@ bool mm_checkheap(int line) {
 			}
 
 			if (get_size(block) >= min_block_size) {
-        free_count += 1;
+        *free_count += 1;
+#if !TLSF
+        // tree blocks hold tree links instead, see check_tree
+        if (get_size(block) >= tree_min_size) {
+          continue;
+        }
+#endif
 
 				//check free list pointer boundaries
 				block_t *next = get(next_linknode(header_to_payload(block)));
@@ -993,14 +3051,8 @@ bool mm_checkheap(int line) {
 				}
 
 				//check if any block has null prev pointer when it's not a root block.
-				bool is_root = false;
 				if (prev == NULL) {
-					int i = 0;
-					for (i = 0; i < SIZE; i++) {
-						if (block == root_list[i]) {
-							is_root = true;
-						}
-					}
+					bool is_root = (*list_head(cur_arena->root_list, get_size(block)) == block);
 					if (!is_root) {
 					  printf("line %d: not the root block has a NULL prev pointer.", line);
 					  printf(" The block is 0x%lx\n", (unsigned long)block);
@@ -1011,6 +3063,233 @@ bool mm_checkheap(int line) {
 			}
 		}
 	}
+	return true;
+}
+
+#if MM_THREADS
+/*
+ * check_segments: to check every segment of the calling thread's arena.
+ * A segment starts with a prologue on a chunk boundary, at the first of a
+ * run of chunks owned by the arena (segments of one arena never touch).
+ * args:
+ * int line: the number of line calling the heap checker.
+ * size_t *free_count: incremented by the number of free blocks
+ * return: true if no error, false otherwise.
+ */
+static bool check_segments(int line, size_t *free_count) {
+  unsigned char owner = (unsigned char)(cur_arena - arenas + 1);
+  unsigned char *lo = mem_heap_lo();
+  size_t chunks = (mem_heapsize() + chunksize - 1) / chunksize;
+  size_t size;
+
+  for (size_t c = 0; c < chunks; c++) {
+    if (arena_map[c] != owner || (c > 0 && arena_map[c - 1] == owner)) {
+      continue;
+    }
+    word_t *prologue = (word_t *)(lo + c * chunksize);
+    if (extract_size(*prologue) != 0 || !extract_alloc(*prologue)) {
+      printf("line %d: the segment at 0x%lx has no prologue.\n", line, (unsigned long)prologue);
+      return false;
+    }
+    if (!check_blocks(line, (block_t *)(prologue + 1), free_count, &size)) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+/*
+ * check_slabs: to check the slabs with room of the calling thread's arena.
+ * Each must be marked in the slab map, fill an allocated block of the
+ * slab size, count the bits of its bitmap as in use and be linked both
+ * ways.
+ * args:
+ * int line: the number of line calling the heap checker.
+ * return: true if no error, false otherwise.
+ */
+static bool check_slabs(int line) {
+	for (int n = 0; n < SLAB_CLASSES; n++) {
+		size_t size = (size_t)(n + 1) * dsize;
+		size_t count = 0;
+		slab_t *prev = NULL;
+		slab_t *slab;
+
+		for (slab = cur_arena->slabs[n]; slab != NULL; slab = slab->next) {
+			block_t *block = payload_to_header(slab);
+			size_t bits = 0;
+			if (slab_of(slab) != slab) {
+				printf("line %d: a slab is not in the slab map.", line);
+				printf(" The slab is 0x%lx\n", (unsigned long)slab);
+				return false;
+			}
+			if (!get_alloc(block) || get_size(block) != slab_size) {
+				printf("line %d: a slab is not an allocated block of the slab size.", line);
+				printf(" The slab is 0x%lx\n", (unsigned long)slab);
+				return false;
+			}
+			for (int w = 0; w < SLAB_BITMAP; w++) {
+				bits += __builtin_popcountll(slab->bitmap[w]);
+			}
+			if (slab->size != size || ((size_t)1 << slab->shift) != size ||
+			    slab->capacity != slab_last(size) - slab_first(size) ||
+			    (size_t)slab->used + SLAB_BITMAP * 64 - slab->capacity != bits || slab->used >= slab->capacity) {
+				printf("line %d: a slab in class %d has a wrong size or count.", line, n);
+				printf(" The slab is 0x%lx\n", (unsigned long)slab);
+				return false;
+			}
+			if (slab->prev != prev) {
+				printf("line %d: the prev link of a slab is wrong.", line);
+				printf(" The slab is 0x%lx\n", (unsigned long)slab);
+				return false;
+			}
+			count += 1;
+			if (count > SLAB_MAP_SIZE) {
+				printf("line %d: the slab list of class %d has a cycle.\n", line, n);
+				return false;
+			}
+			prev = slab;
+		}
+	}
+	return true;
+}
+
+/*
+ * check_mapped: to check the mapped list for the heap checker. Every
+ * mapped block must be allocated, fill a region that memlib knows of and
+ * be linked both ways; the list must end within the bytes mapped.
+ * args:
+ * int line: the number of line calling the heap checker.
+ * return: true if no error, false otherwise.
+ */
+static bool check_mapped(int line) {
+	size_t pagesize = mem_pagesize();
+	size_t total = 0;
+	block_t *prev = NULL;
+	block_t *block;
+
+	if (map_threshold < map_threshold_min || map_threshold > map_threshold_max) {
+		printf("line %d: the map threshold %zu is out of range.\n", line, map_threshold);
+		return false;
+	}
+	for (block = mapped_list; block != NULL; block = get(mapped_region(block))) {
+		word_t *links = mapped_region(block);
+		size_t length = get_size(block);
+		if ((word_t)links % pagesize != 0 || length % pagesize != 0 || length == 0) {
+			printf("line %d: a mapped block is not page aligned.", line);
+			printf(" The block is 0x%lx\n", (unsigned long)block);
+			return false;
+		}
+		if (!get_alloc(block) || !get_mapped(block)) {
+			printf("line %d: a block on the mapped list is free or not mapped.", line);
+			printf(" The block is 0x%lx\n", (unsigned long)block);
+			return false;
+		}
+		if (!mem_is_mapped(links, length)) {
+			printf("line %d: a mapped block is not inside a mapped region.", line);
+			printf(" The block is 0x%lx\n", (unsigned long)block);
+			return false;
+		}
+		if (get(&links[1]) != prev) {
+			printf("line %d: the prev link of a mapped block is wrong.", line);
+			printf(" The block is 0x%lx\n", (unsigned long)block);
+			return false;
+		}
+		total += length;
+		if (total > mem_mapped()) {
+			printf("line %d: the mapped list is longer than the regions or has a cycle.\n", line);
+			return false;
+		}
+		prev = block;
+	}
+	return true;
+}
+
+/*
+ * The heap checker scans the heap and checks it for possible errors 
+ * args:
+ * int line: the number of line calling this function.
+ * return: true if no error, false otherwise.
+ */
+bool mm_checkheap(int line) {
+   /*
+    * - Checking the heap (implicit list, explicit list, segregated list):
+	∗ 1. Check epilogue and prologue blocks.
+	∗ 2. Check each block’s address alignment.
+	∗ 3. Check heap boundaries.
+	∗ 4. Check each block’s header and footer: size (minimum size), previous/next allocate/free bit
+	* consistency, header and footer matching each other.
+	∗ 5. Check coalescing: no two consecutive free blocks in the heap.
+	* 
+	* – Checking the free list (explicit list, segregated list):
+	∗ 1. All next/previous pointers are consistent (if A’s next pointer points to B, B’s previous
+	* pointer should point to A).
+	∗ 2. All free list pointers are between mem heap lo() and mem heap high().
+	∗ 3. Count free blocks by iterating through every block and traversing free list by pointers and
+	* see if they match.
+	∗ 4. All blocks in each list bucket fall within bucket size range (segregated list)
+	*/
+
+	if (line == 0) {
+		return true;
+	}
+	  
+	// check epilogue block
+	word_t *ep_block = (word_t *)mem_heap_lo();
+	if (ep_block == NULL) {
+		printf("line %d: The epilogue block is null.\n", line);
+		return false;
+	} else {
+		size_t size = extract_size(*ep_block);
+		if (size != 0) {
+			printf("line %d: The size of the epilogue block is not 0.\n", line);
+			return false;
+		}
+		bool alloc = extract_alloc(*ep_block);
+		if (!alloc) {
+			printf("line %d: the epilogue block is not allocated.\n", line);
+			return false;
+		}
+	}
+
+	// check prologue block
+	word_t *pi_block = (word_t *)(mem_heap_hi() - 7);
+#if !MM_THREADS // another arena may not have written it yet
+	if (pi_block == NULL) {
+		printf("line %d: The prologue block is null.\n", line);
+		return false;
+	} else {
+		size_t size = extract_size(*pi_block);
+		if (size != 0) {
+			printf("line %d: The size of the prologue block is not 0.\n", line);
+			return false;
+		}
+		bool alloc = extract_alloc(*pi_block);
+		if (!alloc) {
+			printf("line %d: the prologue block is not allocated.\n", line);
+			return false;
+		}
+	}
+#endif
+
+	block_t *block;
+	size_t free_count = 0;
+
+#if MM_THREADS
+	// other arenas change under our feet, so only walk our own segments
+	if (!check_segments(line, &free_count)) {
+		return false;
+	}
+#else
+	//iterate through every block in the heap.
+	size_t size = 0;
+	if (!check_blocks(line, heap_start, &free_count, &size)) {
+		return false;
+	}
+	if ((word_t)heap_start + size != (word_t)pi_block) {
+		printf("line %d: the blocks do not end at the epilogue.\n", line);
+		return false;
+	}
 
 	// the size of the heap
 	size_t heap_size = mem_heapsize();
@@ -1020,41 +3299,38 @@ bool mm_checkheap(int line) {
 		printf("line %d: the total size of blocks does not match with the heap size.\n", line);
 		return false;
 	}
+#endif
 
 	// check free blocks in segregated lists
-	// check free blocks in segregated lists
   size_t free_in_list_count = 0;
-  for (int n = 1; n < SIZE; n++) {
-    if (root_list[n] != NULL) {
-
-      block_t *root = root_list[n];
-
-        //check if the prev pointer of root block is null.
-      if (get(prev_linknode(header_to_payload(root))) != 0) {
-        printf("line %d: the prev pointer of No.%d root block is not NULL.\n", line, n);
+#if TLSF
+  for (int fl = 0; fl < FL_COUNT; fl++) {
+    // the bitmaps must mark exactly the non-empty lists
+    if ((bool)(cur_arena->tlsf_fl_bitmap & ((uint64_t)1 << fl)) != (cur_arena->tlsf_sl_bitmap[fl] != 0)) {
+      printf("line %d: the first-level bitmap is wrong for class %d.\n", line, fl);
+      return false;
+    }
+    for (int sl = 0; sl < SL_COUNT; sl++) {
+      bool marked = cur_arena->tlsf_sl_bitmap[fl] & ((uint32_t)1 << sl);
+      if (marked != (cur_arena->tlsf_list[fl][sl] != NULL)) {
+        printf("line %d: the second-level bitmap is wrong for list %d/%d.\n", line, fl, sl);
         return false;
       }
-      for (block = root; block != NULL; block = get(next_linknode(header_to_payload(block)))) {
-        if ((word_t)block >= (word_t)heap_start) {
-          free_in_list_count += 1;
-        }
-
-        //check if all blocks in each list bucket fall within bucket size range
-        if (find_listnumber(get_size(block)) != n) {
-          printf("line %d: the size of the block is not in the NO.%d list.", line, n);
-          printf(" The block is 0x%lx\n", (unsigned long)block);
-          return false;
-        }
-
-        //check if all the block in the list is free.
-        if (get_alloc(block)) {
-          printf("line: %d: An allocated block in the free list.", line);
-          printf(" The block is 0x%lx\n", (unsigned long) block);
-          return false;
-        }
+      if (!check_list(line, &cur_arena->tlsf_list[fl][sl], &free_in_list_count)) {
+        return false;
       }
     }
   }
+#else
+  for (int n = 1; n < SIZE - 1; n++) {
+    if (!check_list(line, &cur_arena->root_list[n], &free_in_list_count)) {
+      return false;
+    }
+  }
+  if (!check_tree(line, &cur_arena->root_list[SIZE - 1], &free_in_list_count)) {
+    return false;
+  }
+#endif
 
     //Count free blocks by iterating through every block and traversing free list by pointers and see if they match.
   if (free_in_list_count != free_count) {
@@ -1062,7 +3338,192 @@ bool mm_checkheap(int line) {
     return false;
   }
 
-  return true;
+  // check the tcache: allocated blocks of the bin size inside the heap
+#if DEFER_COALESCE
+  size_t tcache_bytes = 0;
+#endif
+  for (int n = 0; n < TCACHE_LISTS; n++) {
+    int count = 0;
+    for (block = cur_arena->tcache[n]; block != NULL; block = get(next_linknode(header_to_payload(block)))) {
+      count += 1;
+      if ((word_t)block < (word_t)heap_start || (word_t)block >= (word_t)pi_block) {
+        printf("line %d: A tcache block is outside the heap boundaries.", line);
+        printf(" The block is 0x%lx\n", (unsigned long)block);
+        return false;
+      }
+      if (!get_alloc(block) || get_mapped(block) || tcache_index(get_size(block)) != n) {
+        printf("line %d: A tcache block is free or in the wrong bin %d.", line, n);
+        printf(" The block is 0x%lx\n", (unsigned long)block);
+        return false;
+      }
+#if DEFER_COALESCE
+      tcache_bytes += get_size(block);
+      if (tcache_bytes > DEFER_LIMIT) {
+#else
+      if (count > tcache_limit) {
+#endif
+        printf("line %d: The tcache bin %d is too long or has a cycle.\n", line, n);
+        return false;
+      }
+    }
+    if (count != cur_arena->tcache_count[n]) {
+      printf("line %d: The tcache bin %d holds %d blocks but counts %d.\n", line, n, count, cur_arena->tcache_count[n]);
+      return false;
+    }
+  }
+#if DEFER_COALESCE
+  if (tcache_bytes != cur_arena->tcache_bytes) {
+    printf("line %d: The tcache holds %zu bytes but counts %zu.\n", line, tcache_bytes, cur_arena->tcache_bytes);
+    return false;
+  }
+#endif
+
+  if (!check_slabs(line)) {
+    return false;
+  }
+
+#if MM_THREADS
+  // the mapped list is shared with the other threads
+  pthread_mutex_lock(&sbrk_lock);
+  bool ok = check_mapped(line);
+  pthread_mutex_unlock(&sbrk_lock);
+  return ok;
+#else
+  return check_mapped(line);
+#endif
+}
+
+/*
+ * map_to: to finish the cells of a heap map before cell c, giving each
+ * the fraction of its bytes that were summed as allocated.
+ * args:
+ * heap_map_t *hm: the heap map
+ * size_t c: the first cell to leave open
+ * return: none
+ */
+static void map_to(heap_map_t *hm, size_t c) {
+  for (; hm->cell < c; hm->cell++) {
+    word_t start = hm->lo + (word_t)((unsigned __int128)hm->cell * hm->span / hm->cells);
+    word_t end = hm->lo + (word_t)((unsigned __int128)(hm->cell + 1) * hm->span / hm->cells);
+    hm->map[hm->cell] = end > start ? (unsigned char)(255.0 * hm->used / (end - start) + 0.5) : 0;
+    hm->used = 0;
+  }
+}
+
+/*
+ * map_add: to add the bytes [start, end) of the heap to a heap map, of
+ * which a fraction used is allocated. Ranges come in address order.
+ * args:
+ * heap_map_t *hm: the heap map
+ * word_t start, end: the range of bytes
+ * double used: the fraction of the range allocated
+ * return: none
+ */
+static void map_add(heap_map_t *hm, word_t start, word_t end, double used) {
+  if (hm->cells == 0 || end <= start) {
+    return;
+  }
+  size_t c = (size_t)((unsigned __int128)(start - hm->lo) * hm->cells / hm->span);
+  while (start < end && c < hm->cells) {
+    word_t cell_end = hm->lo + (word_t)((unsigned __int128)(c + 1) * hm->span / hm->cells);
+    word_t upto = end < cell_end ? end : cell_end;
+    map_to(hm, c);
+    hm->used += (double)(upto - start) * used;
+    start = upto;
+    c++;
+  }
+}
+
+/*
+ * profile_blocks: to add the blocks of one segment, from its first block
+ * up to the epilogue, to a heap profile and map.
+ * args:
+ * block_t *first: the first block of the segment
+ * mm_profile_t *profile: the profile
+ * heap_map_t *hm: the heap map
+ * return: none
+ */
+static void profile_blocks(block_t *first, mm_profile_t *profile, heap_map_t *hm) {
+  block_t *block;
+
+  for (block = first; get_size(block) != 0; block = find_next(block)) {
+    size_t size = get_size(block);
+    profile->heap_bytes += size;
+    if (get_alloc(block)) {
+      // a slab counts the bytes of its objects in use
+      slab_t *slab = slab_of(header_to_payload(block));
+      double used = slab != NULL ? (double)slab->used * slab->size / size : 1.0;
+      map_add(hm, (word_t)block, (word_t)block + size, used);
+      continue;
+    }
+
+    profile->free_bytes += size;
+    profile->free_blocks += 1;
+    profile->largest_free = max(profile->largest_free, size);
+    int n = 0;
+    while (n < MM_PROFILE_CLASSES - 1 && (dsize << (n + 1)) <= size) {
+      n++;
+    }
+    profile->free_hist[n] += 1;
+#if TLSF
+    if (size == dsize) {
+      n = 0;
+    } else {
+      int fl, sl;
+      tlsf_mapping(size, &fl, &sl);
+      n = 1 + fl;
+    }
+#else
+    n = find_listnumber(size);
+#endif
+    profile->list_blocks[n] += 1;
+  }
+}
+
+/*
+ * mm_profile: to take a snapshot of the heap for the profiler of the
+ * driver (mdriver -H), walking every block from heap_start. With threads,
+ * only the segments of the calling thread's arena are walked.
+ * args:
+ * mm_profile_t *profile: filled in with the sizes and counts of mm.h
+ * unsigned char *map: filled in with the allocated fraction of each of
+ * cells slices of the heap, in 255ths
+ * size_t cells: the number of slices, or 0 for no map
+ * return: none
+ */
+void mm_profile(mm_profile_t *profile, unsigned char *map, size_t cells) {
+  heap_map_t hm = {map, cells, (word_t)mem_heap_lo(), mem_heapsize(), 0, 0};
+
+  memset(profile, 0, sizeof(*profile));
+#if TLSF
+  profile->num_lists = 1 + FL_COUNT;
+#else
+  profile->num_lists = SIZE;
+#endif
+  if (hm.span == 0) {
+    hm.cells = 0;
+  }
+
+#if MM_THREADS
+  unsigned char owner = (unsigned char)(cur_arena - arenas + 1);
+  unsigned char *lo = mem_heap_lo();
+  size_t chunks = (mem_heapsize() + chunksize - 1) / chunksize;
+  for (size_t c = 0; c < chunks; c++) {
+    if (arena_map[c] == owner && (c == 0 || arena_map[c - 1] != owner)) {
+      profile_blocks((block_t *)(lo + c * chunksize + wsize), profile, &hm);
+    }
+  }
+#else
+  profile_blocks(heap_start, profile, &hm);
+#endif
+  map_to(&hm, hm.cells);
+
+  for (int n = 0; n < TCACHE_LISTS; n++) {
+    block_t *block;
+    for (block = cur_arena->tcache[n]; block != NULL; block = get(next_linknode(header_to_payload(block)))) {
+      profile->cached_bytes += get_size(block);
+    }
+  }
 }
 
 /*
@@ -1132,10 +3593,14 @@ static size_t get_size(block_t *block) { return extract_size(block->header); }
 
 /*
  * get_payload_size: returns the payload size of a given block, equal to
- *                   the entire block size minus the header and footer sizes.
+ *                   the entire block size minus the header and footer sizes,
+ *                   and for a mapped block also minus the mapped list links.
  */
 static word_t get_payload_size(block_t *block) {
   size_t asize = get_size(block);
+  if (get_mapped(block)) {
+    return asize - map_offset - wsize;
+  }
   return asize - wsize;
 }
 
@@ -1168,6 +3633,14 @@ static bool get_prev_16B(block_t *block) {
   return (bool)((block->header) & prev_16B_mask);
 }
 
+/*
+ * get_mapped: returns true when the block has a region of its own from
+ *             mem_map, based on the block header's fourth lowest bit.
+ */
+static bool get_mapped(block_t *block) {
+  return (bool)((block->header) & mapped_mask);
+}
+
 
 /*
  * write_header: given a block and its size and allocation status,
@@ -21,5 +21,46 @@ extern void *calloc (size_t nmemb, size_t size);
 
 extern bool mm_init(void);
 
+/* Batch entry points: n blocks of one size, or n frees, in one call;
+   mm_free_batch reorders ptrs */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* User arenas: objects bumped out of chunks, all freed at once by
+   mm_arena_reset or mm_arena_destroy, never by free */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(void);
+extern void *mm_arena_malloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/* Heap profile: a snapshot of the heap blocks and the free lists */
+#define MM_PROFILE_CLASSES 24   /* free block sizes, by power of two */
+#define MM_PROFILE_LISTS 64     /* segregated lists, at most */
+typedef struct {
+    size_t heap_bytes;          /* from the first block to the epilogue */
+    size_t free_bytes;          /* in free blocks */
+    size_t free_blocks;
+    size_t largest_free;
+    size_t cached_bytes;        /* freed, but held allocated by a cache */
+    size_t free_hist[MM_PROFILE_CLASSES];   /* free blocks of 16 << i up
+                                               to 32 << i bytes; the last
+                                               class takes all larger */
+    int num_lists;
+    size_t list_blocks[MM_PROFILE_LISTS];   /* free blocks in each list */
+} mm_profile_t;
+
+/* Fills in *profile and, if cells > 0, a map of the heap: map[i] is the
+   fraction of the i-th of cells equal slices of the heap (mem_heap_lo
+   to mem_heap_hi) that is allocated, in 255ths */
+extern void mm_profile(mm_profile_t *profile, unsigned char *map,
+                       size_t cells);
+
+/* With SIZE_STATS=1, for sizetune: the block sizes, in 16-byte units,
+   that find_fit looks up ([0]) and insert_node puts on the lists ([1]);
+   the last entry counts those of the tree and up */
+#define MM_SIZE_STATS 142
+extern size_t mm_size_stats[2][MM_SIZE_STATS];
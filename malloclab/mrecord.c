@@ -0,0 +1,343 @@
+/*
+ * mrecord.c - LD_PRELOAD interposer that records malloc, calloc, realloc
+ *     and free calls into per-thread logs
+ *
+ * usage: MRECORD_DIR=/tmp/rec LD_PRELOAD=./mrecord.so program args...
+ *        ./rec2rep -o program.rep /tmp/rec/mrecord.<pid>.*.log
+ *
+ * Every thread buffers its records in a log of its own and writes them
+ * out MREC_BUFFER at a time, so the only costs on the allocation path are
+ * a timestamp and a store, with no lock. Logs are written when
+ * they fill up, when their thread exits and when the program exits;
+ * threads still running at exit may lose their last records.
+ *
+ * The interposer's own calls (dlsym, pthread_setspecific) can allocate,
+ * so a thread-local flag makes the calls it makes itself go straight
+ * through unrecorded, and the allocations dlsym makes before the real
+ * functions are known come out of a static bootstrap buffer.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mrecord.h"
+
+#define MREC_BUFFER 4096  /* records a thread buffers between writes */
+#define MREC_PATH   4096  /* max log file name length */
+
+/* The log of one thread */
+typedef struct mrec_log {
+    int fd;                  /* log file, or -1 when closed */
+    int tid;
+    bool idle;               /* its thread has exited; free for another */
+    int count;               /* records buffered */
+    mrec_t recs[MREC_BUFFER];
+    struct mrec_log *next;   /* all the logs, for the exit flush */
+} mrec_log_t;
+
+#define MREC_TLS __thread __attribute__((tls_model("initial-exec")))
+
+static MREC_TLS mrec_log_t *mrec_log;   /* this thread's log */
+static MREC_TLS bool mrec_busy;         /* inside the interposer */
+static MREC_TLS bool mrec_released;     /* log released at thread exit */
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static bool mrec_initializing;
+static bool mrec_done;                  /* past the exit flush */
+static char mrec_dir[MREC_PATH] = ".";
+static pthread_key_t mrec_key;
+static pthread_mutex_t mrec_lock = PTHREAD_MUTEX_INITIALIZER;
+static mrec_log_t *mrec_logs;
+
+/* Bootstrap buffer for dlsym's allocations */
+static char mrec_bootstrap[4096] __attribute__((aligned(16)));
+static size_t mrec_bootstrap_used;
+
+static bool is_bootstrap(void *p)
+{
+    return (char *)p >= mrec_bootstrap &&
+        (char *)p < mrec_bootstrap + sizeof(mrec_bootstrap);
+}
+
+static void *bootstrap_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (size > sizeof(mrec_bootstrap) - mrec_bootstrap_used)
+        return NULL;
+    p = mrec_bootstrap + mrec_bootstrap_used;
+    mrec_bootstrap_used += size;
+    return p;
+}
+
+/*
+ * log_flush - write out the buffered records of a log
+ */
+static void log_flush(mrec_log_t *log)
+{
+    char path[MREC_PATH + 64];   /* the directory, and the file name */
+    char *buf = (char *)log->recs;
+    size_t left = log->count * sizeof(mrec_t);
+    ssize_t n;
+
+    if (log->count == 0)
+        return;
+    if (log->fd < 0) {
+        snprintf(path, sizeof(path), MRECORD_FORMAT, mrec_dir,
+                 (int)getpid(), log->tid);
+        log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+    while (log->fd >= 0 && left > 0 && (n = write(log->fd, buf, left)) > 0) {
+        buf += n;
+        left -= n;
+    }
+    log->count = 0;
+}
+
+/*
+ * log_exit - pthread key destructor: flush and close the log of an
+ *     exiting thread, and leave it for the next new thread.  Calls the
+ *     thread makes after this (from later destructors) are not recorded,
+ *     since another thread may already own the log.
+ */
+static void log_exit(void *arg)
+{
+    mrec_log_t *log = arg;
+
+    mrec_log = NULL;
+    mrec_released = true;
+    log_flush(log);
+    if (log->fd >= 0)
+        close(log->fd);
+    log->fd = -1;
+    pthread_mutex_lock(&mrec_lock);
+    log->idle = true;
+    pthread_mutex_unlock(&mrec_lock);
+}
+
+/*
+ * log_get - the log of this thread, set up on its first call
+ */
+static mrec_log_t *log_get(void)
+{
+    mrec_log_t *log;
+
+    if (mrec_log != NULL)
+        return mrec_log;
+
+    pthread_mutex_lock(&mrec_lock);
+    for (log = mrec_logs; log != NULL && !log->idle; log = log->next)
+        ;
+    if (log == NULL) {
+        log = mmap(NULL, sizeof(*log), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (log == MAP_FAILED) {
+            pthread_mutex_unlock(&mrec_lock);
+            return NULL;
+        }
+        log->next = mrec_logs;
+        mrec_logs = log;
+    }
+    log->fd = -1;
+    log->tid = (int)syscall(SYS_gettid);
+    log->idle = false;
+    log->count = 0;
+    pthread_mutex_unlock(&mrec_lock);
+
+    mrec_log = log;
+    pthread_setspecific(mrec_key, log);
+    return log;
+}
+
+/*
+ * timestamp - the time stamp counter where there is one (rdtscp waits
+ *     for the code before it), which costs a fraction of clock_gettime
+ *     and is in step across the cores of current x86 machines
+ */
+static inline uint64_t timestamp(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi, aux;
+    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+ * record - append one record to the log of this thread
+ */
+static void record(uint32_t type, void *ptr, void *old, size_t size)
+{
+    mrec_log_t *log;
+    mrec_t *rec;
+
+    if (mrec_busy || mrec_done || mrec_released)
+        return;
+    mrec_busy = true;
+    if ((log = log_get()) != NULL) {
+        rec = &log->recs[log->count++];
+        rec->time = timestamp();
+        rec->ptr = (uint64_t)ptr;
+        rec->old = (uint64_t)old;
+        rec->size = size;
+        rec->type = type;
+        rec->tid = log->tid;
+        if (log->count == MREC_BUFFER)
+            log_flush(log);
+    }
+    mrec_busy = false;
+}
+
+/*
+ * fork_prepare, fork_parent - hold mrec_lock across a fork, so that the
+ *     child does not inherit it locked by a thread it does not have
+ */
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&mrec_lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&mrec_lock);
+}
+
+/*
+ * fork_child - in the child of a fork, drop the logs of the parent,
+ *     which the parent writes out itself, and release mrec_lock
+ */
+static void fork_child(void)
+{
+    mrec_log_t *log;
+
+    for (log = mrec_logs; log != NULL; log = log->next) {
+        if (log->fd >= 0)
+            close(log->fd);
+        log->fd = -1;
+        log->count = 0;
+        log->idle = log != mrec_log;
+    }
+    if (mrec_log != NULL)
+        mrec_log->tid = (int)syscall(SYS_gettid);
+    pthread_mutex_unlock(&mrec_lock);
+}
+
+static void mrec_init(void)
+{
+    const char *dir;
+
+    mrec_initializing = true;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    mrec_initializing = false;
+
+    if ((dir = getenv("MRECORD_DIR")) != NULL)
+        snprintf(mrec_dir, sizeof(mrec_dir), "%s", dir);
+    mrec_busy = true;
+    pthread_key_create(&mrec_key, log_exit);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    mrec_busy = false;
+}
+
+__attribute__((constructor)) static void mrec_start(void)
+{
+    if (real_malloc == NULL)
+        mrec_init();
+}
+
+__attribute__((destructor)) static void mrec_finish(void)
+{
+    mrec_log_t *log;
+
+    mrec_busy = true;
+    pthread_mutex_lock(&mrec_lock);
+    for (log = mrec_logs; log != NULL; log = log->next) {
+        log_flush(log);
+        if (log->fd >= 0)
+            close(log->fd);
+        log->fd = -1;
+    }
+    mrec_done = true;
+    pthread_mutex_unlock(&mrec_lock);
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+        if (mrec_initializing)
+            return bootstrap_alloc(size);
+        mrec_init();
+    }
+    if ((p = real_malloc(size)) != NULL)
+        record(MREC_MALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+        if (mrec_initializing)
+            return bootstrap_alloc(nmemb * size); /* static, so zeroed */
+        mrec_init();
+    }
+    if ((p = real_calloc(nmemb, size)) != NULL)
+        record(MREC_CALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    void *p;
+
+    if (real_realloc == NULL) {
+        if (mrec_initializing)
+            return NULL;
+        mrec_init();
+    }
+    if (is_bootstrap(old)) {
+        /* moved out of the bootstrap buffer, as a new block */
+        size_t avail = mrec_bootstrap + sizeof(mrec_bootstrap) - (char *)old;
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, old, size < avail ? size : avail);
+        return p;
+    }
+    p = real_realloc(old, size);
+    /* realloc(old, 0) frees old; failing otherwise, it leaves old alone */
+    if (p != NULL || (old != NULL && size == 0))
+        record(MREC_REALLOC, p, old, size);
+    return p;
+}
+
+void free(void *p)
+{
+    if (p == NULL || is_bootstrap(p))
+        return;
+    if (real_free == NULL)
+        mrec_init();
+    record(MREC_FREE, p, NULL, 0);
+    real_free(p);
+}
@@ -0,0 +1,25 @@
+/*
+ * mrecord.h - the per-thread logs written by the mrecord.so interposer
+ *
+ * Each thread of a recorded program appends fixed-size records to a file
+ * of its own, named MRECORD_FORMAT from the directory in $MRECORD_DIR
+ * (default "."), the process id and the thread id. rec2rep merges the
+ * logs of one process by timestamp into an mdriver trace.
+ */
+#include <stdint.h>
+
+#define MRECORD_FORMAT "%s/mrecord.%d.%d.log"
+
+/* Record types */
+enum { MREC_MALLOC, MREC_CALLOC, MREC_REALLOC, MREC_FREE };
+
+/* One intercepted call, in the byte order of the recording machine */
+typedef struct {
+    uint64_t time;   /* TSC (else CLOCK_MONOTONIC ns): after an allocation
+                        returns, before a free is made */
+    uint64_t ptr;    /* block returned, or freed */
+    uint64_t old;    /* block passed to realloc */
+    uint64_t size;   /* bytes asked for (nmemb * size for calloc) */
+    uint32_t type;   /* MREC_* */
+    uint32_t tid;    /* thread that made the call */
+} mrec_t;
@@ -0,0 +1,263 @@
+/*
+ * mtrace.c - read malloc lab traces, and write and map binary traces
+ *
+ * The text parser is the one mdriver has always used. Parsing the full
+ * trace set that way takes longer than running most allocators on it, so
+ * rep2bin converts each .rep into a .bin that mtrace_map loads with one
+ * mmap and no parsing at all.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mtrace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/*
+ * mtrace_is_binary - true if the file starts with MTRACE_MAGIC.
+ *     The file is rewound either way.
+ */
+bool mtrace_is_binary(FILE *file)
+{
+    char magic[sizeof(((mtrace_header_t *)0)->magic)];
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+        memcmp(magic, MTRACE_MAGIC, sizeof(magic)) == 0;
+
+    rewind(file);
+    return binary;
+}
+
+/*
+ * check_ops - range-check the requests of a trace against its header,
+ *     since the driver uses ids and arenas as array indices.  Returns an
+ *     error message, or NULL if they are all in range.
+ */
+static const char *check_ops(const mtrace_header_t *header,
+                             const traceop_t *ops)
+{
+    int i;
+
+    if (header->num_ids < 0 || header->num_arenas < 0)
+        return "bad trace header";
+    for (i = 0; i < header->num_ops; i++) {
+        const traceop_t *op = &ops[i];
+        switch (op->type) {
+        case FREE:
+            /* -1 is free(NULL) */
+            if (op->index < -1 || op->index >= header->num_ids)
+                return "request id out of range";
+            break;
+        case ALLOC:
+        case REALLOC:
+        case ARENA_ALLOC:
+        case ALLOC_BATCH:
+        case FREE_BATCH:
+            if (op->index < 0 || op->index >= header->num_ids)
+                return "request id out of range";
+            if ((op->type == ALLOC_BATCH || op->type == FREE_BATCH) &&
+                (int64_t)op->index + op->count > header->num_ids)
+                return "batch runs past the last request id";
+            if (op->type == ARENA_ALLOC && op->arena >= header->num_arenas)
+                return "arena id out of range";
+            break;
+        case ARENA_CREATE:
+        case ARENA_RESET:
+        case ARENA_DESTROY:
+            if (op->arena >= header->num_arenas)
+                return "arena id out of range";
+            break;
+        default:
+            return "bogus request type";
+        }
+    }
+    return NULL;
+}
+
+/*
+ * mtrace_read_rep - parse a text trace: the 4-line header and one request
+ *     per line.  Fills in header and returns the malloc'ed requests, or
+ *     returns NULL and points *error at a message.
+ */
+traceop_t *mtrace_read_rep(FILE *file, mtrace_header_t *header,
+                           const char **error)
+{
+    traceop_t *ops;
+    char type[MAXLINE];
+    int index = 0;
+    size_t size;
+    int max_index = 0;
+    int arena = 0;
+    int max_arena = -1;
+    int count = 0;
+    int op_index = 0;
+    int ignore = 0;
+    long long data_bytes = 0;
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MTRACE_MAGIC, sizeof(header->magic));
+    header->version = MTRACE_VERSION;
+    header->op_size = sizeof(traceop_t);
+    ignore += fscanf(file, "%d", &header->weight);
+    ignore += fscanf(file, "%d", &header->num_ids);
+    ignore += fscanf(file, "%d", &header->num_ops);
+    ignore += fscanf(file, "%lld", &data_bytes);
+    header->data_bytes = data_bytes;
+
+    if (header->num_ops < 0 || header->num_ids < 0) {
+        *error = "bad trace header";
+        return NULL;
+    }
+
+    /* We'll store each request line in the trace in this array */
+    if ((ops = calloc(header->num_ops + 1, sizeof(traceop_t))) == NULL) {
+        *error = "out of memory";
+        return NULL;
+    }
+
+    /* read every request line in the trace file */
+    while (op_index < header->num_ops && fscanf(file, "%s", type) != EOF) {
+        switch(type[0]) {
+        case 'a':
+            ignore += fscanf(file, "%u %lu", &index, &size);
+            ops[op_index].type = ALLOC;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'r':
+            ignore += fscanf(file, "%u %lu", &index, &size);
+            ops[op_index].type = REALLOC;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'f':
+            ignore += fscanf(file, "%u", &index);
+            ops[op_index].type = FREE;
+            ops[op_index].index = index;
+            break;
+        case 'A':
+            ignore += fscanf(file, "%u %u %lu", &arena, &index, &size);
+            ops[op_index].type = ARENA_ALLOC;
+            ops[op_index].arena = arena;
+            ops[op_index].index = index;
+            ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            max_arena = (arena > max_arena) ? arena : max_arena;
+            break;
+        case 'M':
+            ignore += fscanf(file, "%u %u %lu", &index, &count, &size);
+            ops[op_index].type = ALLOC_BATCH;
+            ops[op_index].index = index;
+            ops[op_index].count = count;
+            ops[op_index].size = size;
+            max_index = (index + count - 1 > max_index) ?
+                index + count - 1 : max_index;
+            break;
+        case 'F':
+            ignore += fscanf(file, "%u %u", &index, &count);
+            ops[op_index].type = FREE_BATCH;
+            ops[op_index].index = index;
+            ops[op_index].count = count;
+            break;
+        case 'C':
+        case 'X':
+        case 'D':
+            ignore += fscanf(file, "%u", &arena);
+            ops[op_index].type = type[0] == 'C' ? ARENA_CREATE :
+                type[0] == 'X' ? ARENA_RESET : ARENA_DESTROY;
+            ops[op_index].arena = arena;
+            ops[op_index].index = -1;
+            max_arena = (arena > max_arena) ? arena : max_arena;
+            break;
+        default:
+            *error = "bogus type character";
+            free(ops);
+            return NULL;
+        }
+        if (arena < 0 || arena > MTRACE_MAX_COUNT ||
+            count < 0 || count > MTRACE_MAX_COUNT) {
+            *error = "arena id or batch count out of range";
+            free(ops);
+            return NULL;
+        }
+        op_index++;
+    }
+
+    if (op_index != header->num_ops) {
+        *error = "fewer requests than the header says";
+        free(ops);
+        return NULL;
+    }
+    if (max_index != header->num_ids - 1) {
+        *error = "request ids do not match the header";
+        free(ops);
+        return NULL;
+    }
+    header->num_arenas = max_arena + 1;
+    if ((*error = check_ops(header, ops)) != NULL) {
+        free(ops);
+        return NULL;
+    }
+    return ops;
+}
+
+/*
+ * mtrace_map - map a binary trace read-only.  Fills in header and returns
+ *     the requests, which stay valid until mtrace_unmap, or returns NULL
+ *     and points *error at a message.
+ */
+traceop_t *mtrace_map(FILE *file, mtrace_header_t *header, size_t *length,
+                      const char **error)
+{
+    struct stat st;
+    char *map;
+
+    if (fstat(fileno(file), &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+        *error = "truncated binary trace";
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        *error = strerror(errno);
+        return NULL;
+    }
+    memcpy(header, map, sizeof(*header));
+
+    /* a trace of another version or byte order is rejected here */
+    if (header->version != MTRACE_VERSION ||
+        header->op_size != sizeof(traceop_t)) {
+        *error = "binary trace of another version; convert it again";
+    } else if (header->num_ops < 0 || (size_t)st.st_size != sizeof(*header)
+               + (size_t)header->num_ops * sizeof(traceop_t)) {
+        *error = "truncated binary trace";
+    } else if ((*error = check_ops(header,
+                   (traceop_t *)(map + sizeof(*header)))) == NULL) {
+        *length = st.st_size;
+        return (traceop_t *)(map + sizeof(*header));
+    }
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+/*
+ * mtrace_unmap - unmap the requests of mtrace_map
+ */
+void mtrace_unmap(traceop_t *ops, size_t length)
+{
+    munmap((char *)ops - sizeof(mtrace_header_t), length);
+}
+
+/*
+ * mtrace_write - write a binary trace: the header, then the requests
+ */
+bool mtrace_write(FILE *file, const mtrace_header_t *header,
+                  const traceop_t *ops)
+{
+    return fwrite(header, sizeof(*header), 1, file) == 1 &&
+        fwrite(ops, sizeof(traceop_t), header->num_ops, file) ==
+        (size_t)header->num_ops;
+}
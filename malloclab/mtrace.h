@@ -0,0 +1,68 @@
+/*
+ * mtrace.h - malloc lab traces in memory and in the binary trace format
+ *
+ * A text trace (.rep, see traces/README) is parsed line by line. A binary
+ * trace (.bin, written by rep2bin) is an mtrace_header_t followed by the
+ * num_ops traceop_t records exactly as they are laid out in memory, so
+ * the driver maps the file and uses the records in place. Binary traces
+ * are in the byte order of the host that wrote them.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The first 8 bytes of a binary trace */
+#define MTRACE_MAGIC   "MLTRACE\0"
+
+/* Bumped whenever the header or traceop_t changes */
+#define MTRACE_VERSION 1
+
+/* Request types */
+enum { ALLOC, FREE, REALLOC,
+       ARENA_CREATE, ARENA_ALLOC, ARENA_RESET, ARENA_DESTROY,
+       ALLOC_BATCH, FREE_BATCH };
+
+/* Characterizes a single trace operation (allocator request), in 16 bytes */
+typedef struct {
+    uint64_t size;      /* byte size of alloc/realloc request */
+    int32_t index;      /* index for free() to use later */
+    uint16_t type;      /* type of request */
+    union {
+        uint16_t arena; /* user arena of the ARENA_* requests */
+        uint16_t count; /* blocks index.. of the *_BATCH ones */
+    };
+} traceop_t;
+
+/* Limit on the arena ids and batch counts that fit in a traceop_t */
+#define MTRACE_MAX_COUNT UINT16_MAX
+
+/* The header of a binary trace, also filled in for a text trace */
+typedef struct {
+    char magic[8];      /* MTRACE_MAGIC */
+    uint32_t version;   /* MTRACE_VERSION */
+    uint32_t op_size;   /* sizeof(traceop_t) */
+    int32_t weight;     /* weight for this trace */
+    int32_t num_ids;    /* number of alloc/realloc ids */
+    int32_t num_ops;    /* number of requests */
+    int32_t num_arenas; /* number of user arena ids */
+    uint64_t data_bytes; /* peak number of data bytes allocated */
+} mtrace_header_t;
+
+/* Returns true if the file starts like a binary trace; rewinds it */
+bool mtrace_is_binary(FILE *file);
+
+/* Parses a text trace; returns its requests (malloc'ed) or NULL and a
+   message in *error */
+traceop_t *mtrace_read_rep(FILE *file, mtrace_header_t *header,
+                           const char **error);
+
+/* Maps a binary trace read-only; returns its requests or NULL and a
+   message in *error. *length is what to pass to mtrace_unmap. */
+traceop_t *mtrace_map(FILE *file, mtrace_header_t *header, size_t *length,
+                      const char **error);
+void mtrace_unmap(traceop_t *ops, size_t length);
+
+/* Writes a binary trace; returns false with errno set on failure */
+bool mtrace_write(FILE *file, const mtrace_header_t *header,
+                  const traceop_t *ops);
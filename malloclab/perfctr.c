@@ -0,0 +1,140 @@
+/*
+ * perfctr.c - hardware performance counters via perf_event_open
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+const char *perfctr_names[NUM_PERFCTRS] = {
+    "instrs", "cycles", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* File descriptor of each counter, or -1 */
+static int perfctr_fds[NUM_PERFCTRS] = { -1, -1, -1, -1, -1 };
+
+/* Type and config of each counter, in PERFCTR_* order */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perfctr_events[NUM_PERFCTRS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* The value read from a counter, with the times for scaling */
+struct perfctr_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+bool perfctr_open(const char **error)
+{
+    struct perf_event_attr attr;
+    int i, opened = 0, open_errno = 0;
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perfctr_events[i].type;
+        attr.config = perfctr_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perfctr_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perfctr_fds[i] >= 0)
+            opened++;
+        else if (open_errno == 0)
+            open_errno = errno;
+    }
+    if (opened == 0) {
+        *error = strerror(open_errno);
+        return false;
+    }
+    return true;
+}
+
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        if (perfctr_fds[i] >= 0) {
+            ioctl(perfctr_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perfctr_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perfctr_stop(double counts[NUM_PERFCTRS])
+{
+    struct perfctr_value v;
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++)
+        if (perfctr_fds[i] >= 0)
+            ioctl(perfctr_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        counts[i] = -1;
+        if (perfctr_fds[i] < 0 ||
+            read(perfctr_fds[i], &v, sizeof(v)) != sizeof(v) ||
+            v.time_running == 0)
+            continue;
+        counts[i] = (double)v.value;
+        if (v.time_running < v.time_enabled)
+            counts[i] *= (double)v.time_enabled / v.time_running;
+    }
+}
+
+void perfctr_close(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++) {
+        if (perfctr_fds[i] >= 0)
+            close(perfctr_fds[i]);
+        perfctr_fds[i] = -1;
+    }
+}
+
+#else /* !__linux__ */
+
+bool perfctr_open(const char **error)
+{
+    *error = "perf_event_open is Linux only";
+    return false;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(double counts[NUM_PERFCTRS])
+{
+    int i;
+
+    for (i = 0; i < NUM_PERFCTRS; i++)
+        counts[i] = -1;
+}
+
+void perfctr_close(void)
+{
+}
+
+#endif /* __linux__ */
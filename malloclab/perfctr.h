@@ -0,0 +1,30 @@
+/*
+ * perfctr.h - hardware performance counters around a piece of code
+ *
+ * On Linux the counters come from perf_event_open, counting user-mode
+ * events of this process only, which perf_event_paranoid <= 2 allows.
+ * Each counter is opened on its own, so a machine (or virtual machine)
+ * without one of them still reports the others.
+ */
+#include <stdbool.h>
+
+/* The events counted */
+enum { PERFCTR_INSTRUCTIONS, PERFCTR_CYCLES, PERFCTR_CACHE_MISSES,
+       PERFCTR_DTLB_MISSES, PERFCTR_BRANCH_MISSES, NUM_PERFCTRS };
+
+/* Short names of the events, for column headings */
+extern const char *perfctr_names[NUM_PERFCTRS];
+
+/* Opens the counters; returns false, with a message in *error, if none
+   of them is available */
+bool perfctr_open(const char **error);
+
+/* Starts counting from zero */
+void perfctr_start(void);
+
+/* Stops counting and stores the count of each event in counts, or -1
+   for an event whose counter is unavailable.  Counts are scaled up if
+   the kernel had to multiplex the counters. */
+void perfctr_stop(double counts[NUM_PERFCTRS]);
+
+void perfctr_close(void);
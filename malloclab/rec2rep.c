@@ -0,0 +1,382 @@
+/*
+ * rec2rep.c - convert the logs of mrecord.so into an mdriver trace
+ *
+ * usage: rec2rep [-w <weight>] [-o <file>] <log>...
+ *
+ * The logs of the threads of one recorded process are merged by
+ * timestamp. Block addresses are renumbered into the dense request ids
+ * of a trace: every malloc, calloc, or realloc of NULL gets the next id,
+ * and a realloc keeps the id of its block. Frees of blocks the logs never
+ * saw allocated (before the recording started, or by memalign) are
+ * dropped, and the blocks still live at the end are freed. The trace
+ * goes to stdout, or to <file>: a .rep, or a binary trace (see mtrace.h)
+ * if <file> ends in .bin.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mrecord.h"
+#include "mtrace.h"
+
+/* One log, read whole */
+typedef struct {
+    mrec_t *recs;
+    size_t count;
+    size_t next;             /* next record to merge */
+} log_t;
+
+/* Open-addressed map from live block addresses to request ids */
+typedef struct {
+    uint64_t *addrs;         /* 0 in an empty slot */
+    int *ids;
+    size_t mask;             /* number of slots - 1 */
+    size_t used;
+} idmap_t;
+
+/* The trace being built */
+static traceop_t *ops;
+static size_t num_ops, max_ops;
+static size_t *sizes;        /* payload size of each id */
+static size_t max_ids;
+static int num_ids;
+static size_t live_bytes, peak_bytes;
+static idmap_t map;
+
+static void app_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "rec2rep: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+/*
+ * read_log - read a whole log file into memory
+ */
+static void read_log(const char *name, log_t *log)
+{
+    struct stat st;
+    int fd;
+    ssize_t n;
+    size_t got = 0;
+
+    if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        app_error(strerror(errno), name);
+    if (st.st_size % sizeof(mrec_t) != 0)
+        app_error("not an mrecord log", name);
+    if ((log->recs = malloc(st.st_size + 1)) == NULL)
+        app_error("out of memory", NULL);
+    while (got < (size_t)st.st_size &&
+           (n = read(fd, (char *)log->recs + got, st.st_size - got)) > 0)
+        got += n;
+    if (got != (size_t)st.st_size)
+        app_error("short read", name);
+    close(fd);
+    log->count = st.st_size / sizeof(mrec_t);
+    log->next = 0;
+}
+
+/*
+ * map_slot - the slot of addr in the map, or the empty slot it would go in
+ */
+static size_t map_slot(uint64_t addr)
+{
+    size_t i = (addr >> 4) * 0x9e3779b97f4a7c15ULL >> 16 & map.mask;
+
+    while (map.addrs[i] != 0 && map.addrs[i] != addr)
+        i = (i + 1) & map.mask;
+    return i;
+}
+
+static void map_insert(uint64_t addr, int id)
+{
+    size_t i;
+
+    if (2 * (map.used + 1) > map.mask + 1) {
+        /* grow to twice the slots, and rehash */
+        idmap_t old = map;
+        map.mask = old.mask * 2 + 1;
+        map.used = 0;
+        map.addrs = calloc(map.mask + 1, sizeof(uint64_t));
+        map.ids = calloc(map.mask + 1, sizeof(int));
+        if (map.addrs == NULL || map.ids == NULL)
+            app_error("out of memory", NULL);
+        for (i = 0; i <= old.mask; i++)
+            if (old.addrs[i] != 0)
+                map_insert(old.addrs[i], old.ids[i]);
+        free(old.addrs);
+        free(old.ids);
+    }
+    i = map_slot(addr);
+    if (map.addrs[i] == 0)
+        map.used++;
+    map.addrs[i] = addr;
+    map.ids[i] = id;
+}
+
+/*
+ * map_remove - remove addr, returning its id, or -1 if it is not there.
+ *     The entries after it in its probe run are shifted back into the hole.
+ */
+static int map_remove(uint64_t addr)
+{
+    size_t i = map_slot(addr), j, home;
+    int id;
+
+    if (map.addrs[i] == 0)
+        return -1;
+    id = map.ids[i];
+    map.addrs[i] = 0;
+    map.used--;
+    for (j = (i + 1) & map.mask; map.addrs[j] != 0; j = (j + 1) & map.mask) {
+        home = (map.addrs[j] >> 4) * 0x9e3779b97f4a7c15ULL >> 16 & map.mask;
+        /* move j back to i unless its home lies cyclically in (i, j] */
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            map.addrs[i] = map.addrs[j];
+            map.ids[i] = map.ids[j];
+            map.addrs[j] = 0;
+            i = j;
+        }
+    }
+    return id;
+}
+
+/*
+ * emit - append one request to the trace
+ */
+static void emit(int type, int id, size_t size)
+{
+    if (num_ops == max_ops) {
+        max_ops = max_ops ? 2 * max_ops : 4096;
+        if ((ops = realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+            app_error("out of memory", NULL);
+    }
+    memset(&ops[num_ops], 0, sizeof(traceop_t));
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * emit_free - free the block at addr, if it is live
+ */
+static bool emit_free(uint64_t addr)
+{
+    int id = map_remove(addr);
+
+    if (id < 0)
+        return false;
+    emit(FREE, id, 0);
+    live_bytes -= sizes[id];
+    sizes[id] = 0;
+    return true;
+}
+
+/*
+ * emit_alloc - a new block of size bytes at addr
+ */
+static void emit_alloc(uint64_t addr, size_t size)
+{
+    /* a block at addr still live means its free was missed, or raced
+       with this allocation in another thread */
+    emit_free(addr);
+    if (size == 0)
+        size = 1;       /* mm_malloc(0) returns NULL, malloc(0) a block */
+    if ((size_t)num_ids == max_ids) {
+        max_ids = max_ids ? 2 * max_ids : 4096;
+        if ((sizes = realloc(sizes, max_ids * sizeof(size_t))) == NULL)
+            app_error("out of memory", NULL);
+    }
+    sizes[num_ids] = size;
+    map_insert(addr, num_ids);
+    emit(ALLOC, num_ids++, size);
+    live_bytes += size;
+    peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+}
+
+/*
+ * convert - turn one record into trace requests; returns false if it
+ *     was dropped
+ */
+static bool convert(const mrec_t *rec)
+{
+    int id;
+    size_t size;
+
+    switch (rec->type) {
+    case MREC_MALLOC:
+    case MREC_CALLOC:
+        emit_alloc(rec->ptr, rec->size);
+        return true;
+
+    case MREC_REALLOC:
+        if (rec->old == 0 || (id = map_remove(rec->old)) < 0) {
+            /* realloc(NULL, size), or of a block never seen */
+            if (rec->ptr == 0)
+                return false;
+            emit_alloc(rec->ptr, rec->size);
+            return true;
+        }
+        if (rec->ptr == 0) {
+            /* realloc(old, 0) freed it */
+            emit(FREE, id, 0);
+            live_bytes -= sizes[id];
+            sizes[id] = 0;
+            return true;
+        }
+        emit_free(rec->ptr);
+        map_insert(rec->ptr, id);
+        size = rec->size ? rec->size : 1;   /* a block, as above */
+        emit(REALLOC, id, size);
+        live_bytes += size - sizes[id];
+        sizes[id] = size;
+        peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+        return true;
+
+    case MREC_FREE:
+        return emit_free(rec->ptr);
+
+    default:
+        app_error("bad record type", NULL);
+    }
+    return false;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * free_live - free the blocks still live at the end, in id order, since
+ *     mdriver runs each trace more than once on the same checker
+ */
+static void free_live(void)
+{
+    int *live, n = 0, i;
+    size_t slot;
+
+    if ((live = malloc((map.used + 1) * sizeof(int))) == NULL)
+        app_error("out of memory", NULL);
+    for (slot = 0; slot <= map.mask; slot++)
+        if (map.addrs[slot] != 0)
+            live[n++] = map.ids[slot];
+    qsort(live, n, sizeof(int), id_cmp);
+    for (i = 0; i < n; i++)
+        emit(FREE, live[i], 0);
+    free(live);
+}
+
+/*
+ * write_rep - write the trace in the text format of traces/README
+ */
+static bool write_rep(FILE *file, const mtrace_header_t *header)
+{
+    size_t i;
+
+    fprintf(file, "%d\n%d\n%d\n%llu\n", header->weight, header->num_ids,
+            header->num_ops, (unsigned long long)header->data_bytes);
+    for (i = 0; i < num_ops; i++) {
+        switch (ops[i].type) {
+        case ALLOC:
+            fprintf(file, "a %d %llu\n", ops[i].index,
+                    (unsigned long long)ops[i].size);
+            break;
+        case REALLOC:
+            fprintf(file, "r %d %llu\n", ops[i].index,
+                    (unsigned long long)ops[i].size);
+            break;
+        case FREE:
+            fprintf(file, "f %d\n", ops[i].index);
+            break;
+        }
+    }
+    return !ferror(file);
+}
+
+int main(int argc, char **argv)
+{
+    log_t *logs;
+    int num_logs, i, c, best;
+    int weight = 1;
+    const char *outname = NULL;
+    size_t records = 0, dropped = 0;
+    mtrace_header_t header;
+    FILE *out = stdout;
+    bool ok;
+
+    while ((c = getopt(argc, argv, "w:o:h")) != -1) {
+        switch (c) {
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-w <weight>] [-o <file>] <log>...\n",
+                    argv[0]);
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    num_logs = argc - optind;
+    if (num_logs < 1)
+        app_error("no logs given", NULL);
+    if ((logs = calloc(num_logs, sizeof(log_t))) == NULL)
+        app_error("out of memory", NULL);
+    for (i = 0; i < num_logs; i++)
+        read_log(argv[optind + i], &logs[i]);
+
+    map.mask = 1023;
+    map.addrs = calloc(map.mask + 1, sizeof(uint64_t));
+    map.ids = calloc(map.mask + 1, sizeof(int));
+    if (map.addrs == NULL || map.ids == NULL)
+        app_error("out of memory", NULL);
+
+    /* merge the logs, each already in time order; ties go to the
+       earlier log on the command line */
+    for (;;) {
+        best = -1;
+        for (i = 0; i < num_logs; i++)
+            if (logs[i].next < logs[i].count &&
+                (best < 0 || logs[i].recs[logs[i].next].time <
+                 logs[best].recs[logs[best].next].time))
+                best = i;
+        if (best < 0)
+            break;
+        records++;
+        if (!convert(&logs[best].recs[logs[best].next++]))
+            dropped++;
+    }
+    if (num_ids == 0)
+        app_error("no allocations recorded", NULL);
+    free_live();
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MTRACE_MAGIC, sizeof(header.magic));
+    header.version = MTRACE_VERSION;
+    header.op_size = sizeof(traceop_t);
+    header.weight = weight;
+    header.num_ids = num_ids;
+    header.num_ops = num_ops;
+    header.data_bytes = peak_bytes;
+
+    if (outname != NULL && (out = fopen(outname, "w")) == NULL)
+        app_error(strerror(errno), outname);
+    if (outname != NULL && strlen(outname) > 4 &&
+        strcmp(outname + strlen(outname) - 4, ".bin") == 0)
+        ok = mtrace_write(out, &header, ops);
+    else
+        ok = write_rep(out, &header);
+    if (fclose(out) != 0 || !ok)
+        app_error("write failed", outname);
+
+    fprintf(stderr, "%zu records from %d threads: %zu requests on %d ids, "
+            "%zu dropped, peak %zu bytes\n", records, num_logs, num_ops,
+            num_ids, dropped, peak_bytes);
+    return 0;
+}
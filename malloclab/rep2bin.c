@@ -0,0 +1,80 @@
+/*
+ * rep2bin.c - convert malloc lab text traces to binary traces
+ *
+ * usage: rep2bin <file.rep>...
+ *
+ * Writes file.bin next to each file.rep, in the format of mtrace.h, for
+ * mdriver to map instead of parse (mdriver -b, or -f file.bin).
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mtrace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/*
+ * convert - write the binary version of one text trace; returns false
+ *     after printing a message on failure
+ */
+static bool convert(const char *repname)
+{
+    char binname[MAXLINE];
+    mtrace_header_t header;
+    const char *error = NULL;
+    traceop_t *ops;
+    FILE *file;
+    bool ok;
+    size_t len = strlen(repname);
+
+    if (len < 4 || strcmp(repname + len - 4, ".rep") != 0 ||
+        len >= sizeof(binname)) {
+        fprintf(stderr, "%s: not a .rep file\n", repname);
+        return false;
+    }
+    strcpy(binname, repname);
+    strcpy(binname + len - 4, ".bin");
+
+    if ((file = fopen(repname, "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", repname, strerror(errno));
+        return false;
+    }
+    ops = mtrace_read_rep(file, &header, &error);
+    fclose(file);
+    if (ops == NULL) {
+        fprintf(stderr, "%s: %s\n", repname, error);
+        return false;
+    }
+
+    if ((file = fopen(binname, "w")) == NULL) {
+        fprintf(stderr, "%s: %s\n", binname, strerror(errno));
+        free(ops);
+        return false;
+    }
+    ok = mtrace_write(file, &header, ops);
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", binname, strerror(errno));
+        remove(binname);
+    }
+    free(ops);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int errors = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.rep>...\n", argv[0]);
+        exit(1);
+    }
+    for (i = 1; i < argc; i++)
+        if (!convert(argv[i]))
+            errors++;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * sizeclass.h - the segregated list of each free block size, for mm.c
+ *
+ * Generated by sizetune -d: the default classes.
+ *
+ * size_class[k] is the list of the free blocks of k * 16 bytes; blocks
+ * of 141 * 16 bytes and up go in the tree, list 14.
+ *
+ * Lists, by size in 16-byte units:
+ *     0: 1, 1: 2, 2: 3-4, 3: 5-6, 4: 7-9,
+ *     5: 10-12, 6: 13-15, 7: 16-20, 8: 21-26, 9: 27-36,
+ *     10: 37-50, 11: 51-70, 12: 71-99, 13: 100-140
+ */
+static const unsigned char size_class[141] = {
+     0,  0,  1,  2,  2,  3,  3,  4,  4,  4,  5,  5,  5,  6,  6,  6,
+     7,  7,  7,  7,  7,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,
+     9,  9,  9,  9,  9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13
+};
@@ -0,0 +1,287 @@
+/*
+ * sizetune.c - derive the size classes of the segregated lists of mm.c
+ *     from the block sizes that traces send to them
+ *
+ * usage: sizetune [-o <file>] <trace>...
+ *        sizetune -d [-o <file>]
+ *
+ * Each trace (.rep or .bin) is replayed through a build of mm.c with
+ * SIZE_STATS=1, which counts the block sizes that find_fit looks up and
+ * that insert_node puts on the lists. Requests the tcache or the slabs
+ * serve never get there, so they do not count. The classes are then
+ * chosen to make the lists narrow where that traffic is heavy: they
+ * minimize the sum over the classes of their traffic times their width
+ * in 16-byte units, the sizes find_fit may have to skip in the list it
+ * starts from. The table for mm.c goes to sizeclass.h format on stdout,
+ * or to <file>; -d writes the default classes instead.
+ *
+ * The 16-byte blocks keep a list of their own (they have no room for
+ * two links) and blocks of tree_min_size and up the tree, so only the
+ * classes in between are tuned.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "memlib.h"
+#include "mm.h"
+#include "mtrace.h"
+
+#define CLASSES  15     /* SIZE in mm.c: the lists, the tree the last */
+#define UNITS   141     /* tree_min_size / 16: table entries */
+
+/* Largest size, in 16-byte units, of each list but the tree's */
+static const int default_bounds[CLASSES - 1] = {
+    1, 2, 4, 6, 9, 12, 15, 20, 26, 36, 50, 70, 99, 140
+};
+
+static void app_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "sizetune: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+/*
+ * replay - run one trace through mm.c, adding to mm_size_stats; traces
+ *     too large for a dense heap (syn-giant*) are skipped
+ */
+static void replay(const char *name)
+{
+    mtrace_header_t header;
+    const char *error = NULL;
+    traceop_t *ops;
+    size_t length = 0;
+    void **blocks;
+    mm_arena_t **arenas;
+    FILE *file;
+    int i;
+
+    if ((file = fopen(name, "r")) == NULL)
+        app_error(strerror(errno), name);
+    if (mtrace_is_binary(file))
+        ops = mtrace_map(file, &header, &length, &error);
+    else
+        ops = mtrace_read_rep(file, &header, &error);
+    fclose(file);
+    if (ops == NULL)
+        app_error(error, name);
+    if (header.data_bytes > MAX_DENSE_HEAP) {
+        fprintf(stderr, "%s: skipped, too large for a dense heap\n", name);
+        if (length > 0)
+            mtrace_unmap(ops, length);
+        else
+            free(ops);
+        return;
+    }
+
+    blocks = calloc(header.num_ids + 1, sizeof(void *));
+    arenas = calloc(header.num_arenas + 1, sizeof(mm_arena_t *));
+    if (blocks == NULL || arenas == NULL)
+        app_error("out of memory", NULL);
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed", name);
+    for (i = 0; i < header.num_ops; i++) {
+        traceop_t *op = &ops[i];
+        switch (op->type) {
+        case ALLOC:
+            if ((blocks[op->index] = mm_malloc(op->size)) == NULL)
+                app_error("mm_malloc failed", name);
+            break;
+        case REALLOC:
+            setUBCheck(false);
+            blocks[op->index] = mm_realloc(blocks[op->index], op->size);
+            setUBCheck(true);
+            if (blocks[op->index] == NULL && op->size != 0)
+                app_error("mm_realloc failed", name);
+            break;
+        case FREE:
+            mm_free(op->index < 0 ? NULL : blocks[op->index]);
+            break;
+        case ARENA_CREATE:
+            if ((arenas[op->arena] = mm_arena_create()) == NULL)
+                app_error("mm_arena_create failed", name);
+            break;
+        case ARENA_ALLOC:
+            blocks[op->index] = mm_arena_malloc(arenas[op->arena], op->size);
+            break;
+        case ARENA_RESET:
+            mm_arena_reset(arenas[op->arena]);
+            break;
+        case ARENA_DESTROY:
+            mm_arena_destroy(arenas[op->arena]);
+            break;
+        case ALLOC_BATCH:
+            if (mm_malloc_batch(op->size, op->count, &blocks[op->index]) !=
+                op->count)
+                app_error("mm_malloc_batch failed", name);
+            break;
+        case FREE_BATCH:
+            mm_free_batch(&blocks[op->index], op->count);
+            break;
+        }
+    }
+
+    if (length > 0)
+        mtrace_unmap(ops, length);
+    else
+        free(ops);
+    free(blocks);
+    free(arenas);
+}
+
+/*
+ * tune - the bounds of classes 1 .. CLASSES - 2 minimizing the sum of
+ *     traffic times width, by dynamic programming over the sizes 2 ..
+ *     UNITS - 1; class 0 stays the 16-byte blocks
+ */
+static void tune(const double traffic[UNITS], int bounds[CLASSES - 1])
+{
+    static double cost[CLASSES][UNITS];
+    static int cut[CLASSES][UNITS];
+    double prefix[UNITS + 1], c;
+    int k, n, j, classes = CLASSES - 2;
+
+    prefix[0] = 0;
+    for (k = 0; k < UNITS; k++)
+        prefix[k + 1] = prefix[k] + traffic[k];
+
+    /* cost[n][k]: the best n classes over the sizes 2 .. k, each taking
+       sizes cut[n][k] + 1 .. k in the last */
+    for (n = 1; n <= classes; n++) {
+        for (k = n + 1; k < UNITS; k++) {
+            cost[n][k] = -1;
+            for (j = n; j < k; j++) {
+                if (n == 1 && j != 1)
+                    break;
+                c = (prefix[k + 1] - prefix[j + 1]) * (k - j - 1) +
+                    (n > 1 ? cost[n - 1][j] : 0);
+                if (cost[n][k] < 0 || c < cost[n][k]) {
+                    cost[n][k] = c;
+                    cut[n][k] = j;
+                }
+            }
+        }
+    }
+
+    bounds[0] = 1;
+    for (n = classes, k = UNITS - 1; n >= 1; n--) {
+        bounds[n] = k;
+        k = cut[n][k];
+    }
+}
+
+/*
+ * write_table - write sizeclass.h for the given bounds
+ */
+static void write_table(FILE *out, const int bounds[CLASSES - 1],
+                        int argc, char **argv)
+{
+    int k, n, i;
+
+    fprintf(out, "/*\n"
+            " * sizeclass.h - the segregated list of each free block size, "
+            "for mm.c\n"
+            " *\n"
+            " * Generated by sizetune");
+    if (argc == 0)
+        fprintf(out, " -d: the default classes.");
+    else
+        fprintf(out, " from %d trace%s:", argc, argc > 1 ? "s" : "");
+    for (i = 0; i < argc; i++)
+        fprintf(out, "\n *     %s", argv[i]);
+    fprintf(out, "\n"
+            " *\n"
+            " * size_class[k] is the list of the free blocks of k * 16 bytes; "
+            "blocks\n"
+            " * of %d * 16 bytes and up go in the tree, list %d.\n"
+            " *\n"
+            " * Lists, by size in 16-byte units:", UNITS, CLASSES - 1);
+    for (n = 0; n < CLASSES - 1; n++) {
+        int lo = n == 0 ? 1 : bounds[n - 1] + 1;
+        if (n % 5 == 0)
+            fprintf(out, "\n *    ");
+        if (lo == bounds[n])
+            fprintf(out, " %d: %d%s", n, lo, n < CLASSES - 2 ? "," : "");
+        else
+            fprintf(out, " %d: %d-%d%s", n, lo, bounds[n],
+                    n < CLASSES - 2 ? "," : "");
+    }
+    fprintf(out, "\n */\n"
+            "static const unsigned char size_class[%d] = {", UNITS);
+    for (k = 0, n = 0; k < UNITS; k++) {
+        while (k > bounds[n])
+            n++;
+        fprintf(out, "%s%2d%s", k % 16 == 0 ? "\n    " : " ", n,
+                k < UNITS - 1 ? "," : "");
+    }
+    fprintf(out, "\n};\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *outname = NULL;
+    bool defaults = false;
+    double traffic[UNITS], total = 0;
+    int bounds[CLASSES - 1];
+    FILE *out = stdout;
+    int c, k, n, i;
+
+    while ((c = getopt(argc, argv, "do:h")) != -1) {
+        switch (c) {
+        case 'd':
+            defaults = true;
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o <file>] <trace>...\n"
+                    "       %s -d [-o <file>]\n", argv[0], argv[0]);
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (defaults) {
+        memcpy(bounds, default_bounds, sizeof(bounds));
+        argc = 0;
+    } else {
+        if (argc == 0)
+            app_error("no traces given", NULL);
+        mem_init(false);
+        for (i = 0; i < argc; i++)
+            replay(argv[i]);
+        mem_deinit();
+
+        /* lookups and insertions weigh the same */
+        for (k = 0; k < UNITS; k++) {
+            traffic[k] = (double)mm_size_stats[0][k] + mm_size_stats[1][k];
+            total += traffic[k];
+        }
+        if (total == 0)
+            app_error("no block sizes reached the lists", NULL);
+        tune(traffic, bounds);
+
+        for (n = 0; n < CLASSES - 1; n++) {
+            double sum = 0;
+            for (k = n == 0 ? 1 : bounds[n - 1] + 1; k <= bounds[n]; k++)
+                sum += traffic[k];
+            fprintf(stderr, "list %2d: %3d-%3d  %5.1f%%\n", n,
+                    n == 0 ? 1 : bounds[n - 1] + 1, bounds[n],
+                    100.0 * sum / total);
+        }
+    }
+
+    if (outname != NULL && (out = fopen(outname, "w")) == NULL)
+        app_error(strerror(errno), outname);
+    write_table(out, bounds, argc, argv);
+    if (fclose(out) != 0)
+        app_error("write failed", outname);
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+ * tracegen.c - generate a synthetic trace from a declarative spec
+ *
+ * usage: tracegen [-s <seed>] <spec> <file.rep | file.bin>
+ *
+ * A spec is a text file of "key value..." lines ('#' starts a comment).
+ * A few keys apply to the whole trace; the rest describe a phase, and
+ * each "phase" line starts a new one:
+ *
+ *   seed <n>                 random seed (default 1; -s overrides)
+ *   weight <n>               trace weight (default 1)
+ *
+ *   phase                    start a phase
+ *   ops <n>                  requests in the phase
+ *   live <n>                 live-set target: the number of blocks
+ *                            beyond which the oldest-dying block is freed
+ *                            before anything is allocated
+ *   size <dist>              request sizes, in bytes
+ *   lifetime <dist>          block lifetimes, in requests (default: until
+ *                            the live-set target pushes the block out)
+ *   realloc <p> grow <f>     with probability p, a request reallocs a
+ *   realloc <p> add <n>      random live block to f times, or n bytes
+ *                            more than, its size
+ *   free <f>                 at the start of the phase, free a random
+ *                            fraction f of the live blocks
+ *
+ * A <dist> is one of
+ *   fixed <v>
+ *   uniform <lo> <hi>
+ *   powerlaw <lo> <hi> <alpha>   density proportional to x^-alpha
+ *   bimodal <a> <b> <p>          a with probability p, else b
+ *   exponential <mean>
+ *
+ * A phase inherits the size, lifetime and live settings of the one
+ * before it. Blocks outlive the phases they were allocated in, and all
+ * blocks still live at the end are freed. Traces are written as they are
+ * generated, so their length is bounded by disk space rather than memory.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mtrace.h"
+
+#define MAXLINE   1024  /* max string size */
+#define MAXPHASES 64
+
+/* A distribution of sizes or lifetimes */
+typedef enum { D_NONE, D_FIXED, D_UNIFORM, D_POWERLAW, D_BIMODAL,
+               D_EXPONENTIAL } dist_kind_t;
+
+typedef struct {
+    dist_kind_t kind;
+    double a, b, c;
+} dist_t;
+
+/* One phase of the spec */
+typedef struct {
+    long long ops;
+    long long live;
+    dist_t size;
+    dist_t lifetime;        /* D_NONE: until pushed out */
+    double realloc_p;
+    bool realloc_add;       /* grow by realloc_by bytes, else by a factor */
+    double realloc_by;
+    double free_fraction;
+} phase_t;
+
+/* A live block, in a min-heap on the request number it dies at */
+typedef struct {
+    long long death;
+    int id;
+    size_t size;
+} block_t;
+
+static phase_t phases[MAXPHASES];
+static int num_phases;
+static unsigned long long seed = 1;
+static int weight = 1;
+
+static block_t *heap;
+static long long heap_len, heap_max;
+
+/* The trace being written */
+static FILE *out;
+static bool binary;
+static long long num_ops, num_ids;
+static size_t live_bytes, peak_bytes;
+
+static void app_error(const char *fmt, const char *arg, int line)
+{
+    fprintf(stderr, "tracegen: ");
+    fprintf(stderr, fmt, arg, line);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*
+ * rnd - xorshift64*: uniform in [0, 1)
+ */
+static double rnd(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return ((seed * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sample(const dist_t *d)
+{
+    double u = rnd(), e;
+
+    switch (d->kind) {
+    case D_FIXED:
+        return d->a;
+    case D_UNIFORM:
+        return d->a + u * (d->b - d->a + 1);
+    case D_POWERLAW:
+        if (d->c == 1.0)
+            return d->a * pow(d->b / d->a, u);
+        /* inverse of the CDF of x^-alpha on [lo, hi] */
+        e = 1.0 - d->c;
+        return pow(pow(d->a, e) + u * (pow(d->b, e) - pow(d->a, e)), 1.0 / e);
+    case D_BIMODAL:
+        return u < d->c ? d->a : d->b;
+    case D_EXPONENTIAL:
+        return -d->a * log(1.0 - u);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * parse_dist - parse the words of a <dist>; returns false if malformed
+ */
+static bool parse_dist(const char *args, dist_t *d)
+{
+    char kind[MAXLINE];
+    int n;
+
+    memset(d, 0, sizeof(*d));
+    if (sscanf(args, "%s %lf %lf %lf", kind, &d->a, &d->b, &d->c) < 2)
+        return false;
+    n = sscanf(args, "%*s %lf %lf %lf", &d->a, &d->b, &d->c);
+    if (strcmp(kind, "fixed") == 0 && n == 1)
+        d->kind = D_FIXED;
+    else if (strcmp(kind, "uniform") == 0 && n == 2 && d->a <= d->b)
+        d->kind = D_UNIFORM;
+    else if (strcmp(kind, "powerlaw") == 0 && n == 3 && 0 < d->a && d->a <= d->b)
+        d->kind = D_POWERLAW;
+    else if (strcmp(kind, "bimodal") == 0 && n == 3)
+        d->kind = D_BIMODAL;
+    else if (strcmp(kind, "exponential") == 0 && n == 1 && d->a > 0)
+        d->kind = D_EXPONENTIAL;
+    else
+        return false;
+    return true;
+}
+
+/*
+ * read_spec - read the spec file into phases[]
+ */
+static void read_spec(const char *name)
+{
+    FILE *file;
+    char line[MAXLINE], key[MAXLINE], how[MAXLINE];
+    char *args;
+    int lineno = 0;
+    phase_t *p = NULL;
+    bool ok;
+
+    if ((file = fopen(name, "r")) == NULL)
+        app_error("%s: cannot open", name, 0);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineno++;
+        if ((args = strchr(line, '#')) != NULL)
+            *args = '\0';
+        if (sscanf(line, "%s", key) != 1)
+            continue;
+        args = strstr(line, key) + strlen(key);
+
+        if (strcmp(key, "seed") == 0) {
+            ok = sscanf(args, "%llu", &seed) == 1;
+        } else if (strcmp(key, "weight") == 0) {
+            ok = sscanf(args, "%d", &weight) == 1 && weight >= 0 && weight <= 3;
+        } else if (strcmp(key, "phase") == 0) {
+            if (num_phases == MAXPHASES)
+                app_error("%s:%d: too many phases", name, lineno);
+            p = &phases[num_phases++];
+            if (num_phases > 1) {
+                *p = phases[num_phases - 2];    /* inherit */
+                p->realloc_p = 0;
+                p->free_fraction = 0;
+            } else {
+                memset(p, 0, sizeof(*p));
+            }
+            p->ops = 0;
+            ok = true;
+        } else if (p == NULL) {
+            app_error("%s:%d: phase settings before the first phase line",
+                      name, lineno);
+            ok = false;
+        } else if (strcmp(key, "ops") == 0) {
+            ok = sscanf(args, "%lld", &p->ops) == 1 && p->ops >= 0;
+        } else if (strcmp(key, "live") == 0) {
+            ok = sscanf(args, "%lld", &p->live) == 1 && p->live > 0;
+        } else if (strcmp(key, "size") == 0) {
+            ok = parse_dist(args, &p->size);
+        } else if (strcmp(key, "lifetime") == 0) {
+            ok = parse_dist(args, &p->lifetime);
+        } else if (strcmp(key, "realloc") == 0) {
+            ok = sscanf(args, "%lf %s %lf", &p->realloc_p, how,
+                        &p->realloc_by) == 3 &&
+                (strcmp(how, "grow") == 0 || strcmp(how, "add") == 0);
+            p->realloc_add = strcmp(how, "add") == 0;
+        } else if (strcmp(key, "free") == 0) {
+            ok = sscanf(args, "%lf", &p->free_fraction) == 1 &&
+                p->free_fraction >= 0 && p->free_fraction <= 1;
+        } else {
+            ok = false;
+        }
+        if (!ok)
+            app_error("%s:%d: bad line", name, lineno);
+    }
+    fclose(file);
+
+    if (num_phases == 0)
+        app_error("%s: no phases", name, 0);
+    for (p = phases; p < phases + num_phases; p++)
+        if (p->size.kind == D_NONE || p->live == 0)
+            app_error("%s: phase %d needs a size and a live target", name,
+                      (int)(p - phases) + 1);
+}
+
+/*
+ * emit - write one request
+ */
+static void emit(int type, int id, size_t size)
+{
+    traceop_t op;
+
+    if (binary) {
+        memset(&op, 0, sizeof(op));
+        op.type = type;
+        op.index = id;
+        op.size = size;
+        fwrite(&op, sizeof(op), 1, out);
+    } else if (type == ALLOC) {
+        fprintf(out, "a %d %zu\n", id, size);
+    } else if (type == REALLOC) {
+        fprintf(out, "r %d %zu\n", id, size);
+    } else {
+        fprintf(out, "f %d\n", id);
+    }
+    num_ops++;
+}
+
+/*
+ * The heap of live blocks, ordered by death
+ */
+static void heap_up(long long i)
+{
+    block_t b = heap[i];
+
+    while (i > 0 && heap[(i - 1) / 2].death > b.death) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = b;
+}
+
+static void heap_down(long long i)
+{
+    block_t b = heap[i];
+    long long child;
+
+    while ((child = 2 * i + 1) < heap_len) {
+        if (child + 1 < heap_len && heap[child + 1].death < heap[child].death)
+            child++;
+        if (heap[child].death >= b.death)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = b;
+}
+
+/*
+ * free_block - free live block i of the heap
+ */
+static void free_block(long long i)
+{
+    emit(FREE, heap[i].id, 0);
+    live_bytes -= heap[i].size;
+    heap[i] = heap[--heap_len];
+    if (i < heap_len) {
+        heap_up(i);
+        heap_down(i);
+    }
+}
+
+static size_t sample_size(const phase_t *p)
+{
+    double size = sample(&p->size);
+    return size < 1 ? 1 : (size_t)size;
+}
+
+static void alloc_block(const phase_t *p, long long now)
+{
+    block_t *b;
+
+    if (num_ids == INT32_MAX)
+        app_error("%s: more than 2^31 blocks", "trace", 0);
+    if (heap_len == heap_max) {
+        heap_max = heap_max ? 2 * heap_max : 4096;
+        if ((heap = realloc(heap, heap_max * sizeof(block_t))) == NULL)
+            app_error("%s", strerror(errno), 0);
+    }
+    b = &heap[heap_len++];
+    b->id = num_ids++;
+    b->size = sample_size(p);
+    b->death = p->lifetime.kind == D_NONE ? INT64_MAX :
+        now + 1 + (long long)sample(&p->lifetime);
+    emit(ALLOC, b->id, b->size);
+    live_bytes += b->size;
+    peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+    heap_up(heap_len - 1);
+}
+
+static void realloc_block(const phase_t *p)
+{
+    block_t *b = &heap[(long long)(rnd() * heap_len)];
+    size_t size = p->realloc_add ? b->size + (size_t)p->realloc_by :
+        (size_t)(b->size * p->realloc_by);
+
+    size = size < 1 ? 1 : size;
+    emit(REALLOC, b->id, size);
+    live_bytes += size - b->size;
+    peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+    b->size = size;
+}
+
+/*
+ * run_phase - generate the requests of one phase; now counts requests
+ */
+static void run_phase(const phase_t *p, long long *now)
+{
+    long long end, i, n;
+
+    /* thin out the live blocks */
+    n = (long long)(p->free_fraction * heap_len);
+    for (i = 0; i < n && heap_len > 0; i++)
+        free_block((long long)(rnd() * heap_len));
+
+    for (end = *now + p->ops; *now < end; (*now)++) {
+        if (heap_len > 0 && (heap[0].death <= *now || heap_len >= p->live))
+            free_block(0);
+        else if (heap_len > 0 && rnd() < p->realloc_p)
+            realloc_block(p);
+        else
+            alloc_block(p, *now);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    mtrace_header_t header;
+    long long now = 0;
+    int i = 1;
+    bool seed_given = false;
+    unsigned long long seed_arg = 0;
+    size_t len;
+
+    if (argc == 5 && strcmp(argv[1], "-s") == 0) {
+        seed_arg = strtoull(argv[2], NULL, 10);
+        seed_given = true;
+        i = 3;
+    }
+    if (argc - i != 2) {
+        fprintf(stderr, "usage: %s [-s <seed>] <spec> <file.rep | file.bin>\n",
+                argv[0]);
+        exit(1);
+    }
+    read_spec(argv[i]);
+    if (seed_given)
+        seed = seed_arg;
+    seed = seed ? seed : 1;     /* xorshift needs a nonzero state */
+
+    len = strlen(argv[i + 1]);
+    binary = len > 4 && strcmp(argv[i + 1] + len - 4, ".bin") == 0;
+    if ((out = fopen(argv[i + 1], "w")) == NULL)
+        app_error("%s: cannot open", argv[i + 1], 0);
+
+    /* the header is written again with the counts at the end; in a .rep
+       its fields are padded to a fixed width for that */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MTRACE_MAGIC, sizeof(header.magic));
+    header.version = MTRACE_VERSION;
+    header.op_size = sizeof(traceop_t);
+    header.weight = weight;
+    if (binary)
+        fwrite(&header, sizeof(header), 1, out);
+    else
+        fprintf(out, "%-20d\n%-20d\n%-20d\n%-20d\n", 0, 0, 0, 0);
+
+    for (i = 0; i < num_phases; i++)
+        run_phase(&phases[i], &now);
+    while (heap_len > 0)
+        free_block(heap_len - 1);
+
+    if (num_ops > INT32_MAX)
+        app_error("%s: more than 2^31 requests", "trace", 0);
+    header.num_ids = num_ids;
+    header.num_ops = num_ops;
+    header.data_bytes = peak_bytes;
+    rewind(out);
+    if (binary)
+        fwrite(&header, sizeof(header), 1, out);
+    else
+        fprintf(out, "%-20d\n%-20d\n%-20d\n%-20zu\n", weight, header.num_ids,
+                header.num_ops, peak_bytes);
+    if (fclose(out) != 0)
+        app_error("%s: write failed", argv[argc - 1], 0);
+
+    fprintf(stderr, "%lld requests on %lld ids, peak %zu bytes\n", num_ops,
+            num_ids, peak_bytes);
+    return 0;
+}
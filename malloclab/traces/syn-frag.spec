@@ -0,0 +1,29 @@
+# syn-frag.spec - "tracegen traces/syn-frag.spec traces/syn-frag.rep"
+#
+# Swiss cheese: a heap filled with small blocks is thinned out at
+# random, so that most of it is free but in holes too small for the
+# larger blocks that come next. A first-fit or segregated allocator
+# that cannot coalesce the holes grows the heap for every one of them.
+
+seed 15213
+
+# fill the heap with 32- to 96-byte nodes that stay live
+phase
+ops 40000
+live 40000
+size uniform 32 96
+
+# free nine in ten of them, and allocate 256- to 2048-byte buffers
+# among short-lived nodes
+phase
+free 0.9
+ops 40000
+live 6000
+size bimodal 64 1024 0.5
+lifetime exponential 2000
+
+# grow some of the survivors in place, or past their neighbours
+phase
+ops 20000
+size powerlaw 16 4096 1.5
+realloc 0.2 grow 1.5
@@ -0,0 +1,18 @@
+# syn-steady.spec - a long steady state at a fixed live set, for
+# throughput at scale, e.g. "tracegen -s 7 traces/syn-steady.spec
+# traces/syn-steady.bin" with ops raised to 100000000. Not scored.
+
+seed 1
+weight 3
+
+# grow to a live set of 100000 power-law sized blocks
+phase
+ops 100000
+live 100000
+size powerlaw 8 16384 2.0
+
+# then replace them at random, with a realloc now and then
+phase
+ops 1000000
+lifetime exponential 100000
+realloc 0.05 add 64
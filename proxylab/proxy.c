@@ -10,6 +10,7 @@
 
 #include "csapp.h"
 #include "cache.h"
+#include "reqtrace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,14 +65,16 @@ static const char *host_key = "Host";
 static const char *connection_key = "Connection";
 static const char *proxy_connection_key = "Proxy-Connection";
 static const char *user_agent_key = "User-Agent";
+static const char *request_id_key = REQTRACE_HEADER;
 
 /* 
  * Self-defined functions 
  */
 void doit(int connfd);
 void parse_uri(char *uri, char *hostname, char *path, char *port);
-void build_http_header(char *hostname, char *path, 
-	                   char *port, rio_t *client_rio, char *http_header);
+void build_http_header(char *hostname, char *path, char *port,
+	                   rio_t *client_rio, char *http_header,
+	                   uint64_t request_id);
 void *thread(void *vargo);
 void sigpipe_handler(int sig);
 
@@ -108,6 +111,7 @@ int main(int argc, char** argv) {
 	listenfd = Open_listenfd(argv[1]); // argv[1] => port number
 	Signal(SIGPIPE, sigpipe_handler);
 	init_cache();
+	reqtrace_init("proxy");
 
 	while (1) {
 		socklen_t clientlen;
@@ -157,16 +161,25 @@ void doit(int connfd) {
 	char http_header[MAXLINE];
 	rio_t client_rio, server_rio;
 	int serverfd;
+	uint64_t request_id = 0;
 
 	/* read request line from client */
 	Rio_readinitb(&client_rio, connfd);
 	Rio_readlineb(&client_rio, buf, MAXLINE);
+
+	/* tag the request so the origin's trace events can be joined to ours */
+	if (reqtrace_enabled()) {
+		request_id = reqtrace_new_id();
+		reqtrace_event(request_id, EV_PROXY_ACCEPT);
+	}
+
 	/* convert request line to method, uri, version */
 	sscanf(buf, "%s %s %s", method, uri, version);
 
 	/* if method is not GET, print error message */
 	if (strcasecmp(method, "GET")) {
 		sio_printf("Proxy does not implement this method.\n");
+		reqtrace_event(request_id, EV_PROXY_DONE);
 		return;
 	}
 
@@ -177,36 +190,46 @@ void doit(int connfd) {
 
 	/* found - read the content from the block */
 	if (find_block != NULL) {
+		reqtrace_event(request_id, EV_PROXY_CACHE_HIT);
 		read_from_cache(find_block, connfd);
 	} else {
 		/* transform uri into hostname, path and port */
 		parse_uri(uri, hostname, path, port);
 
 		/* build http header */
-		build_http_header(hostname, path, port, &client_rio, http_header);
+		build_http_header(hostname, path, port, &client_rio, http_header,
+		                  request_id);
 
 		/* connect to server */
 		serverfd = open_clientfd(hostname, port);
 		if (serverfd < 0) {
 			sio_printf("connection to server fails.\n");
+			reqtrace_event(request_id, EV_PROXY_DONE);
 			return;
 		}
+		reqtrace_event(request_id, EV_PROXY_CONNECT);
 
 		/* send header to server */
 		Rio_readinitb(&server_rio, serverfd);
 		if (Rio_writen(serverfd, http_header, strlen(http_header)) < 0) {
+			reqtrace_event(request_id, EV_PROXY_DONE);
 			return;
 		}
+		reqtrace_event(request_id, EV_PROXY_SENT);
 
 		int n;
 		char cache_buf[MAX_CACHE_SIZE];
 		char *buf_pointer = cache_buf;
 		size_t size_count = 0;
 		while ((n = rio_readnb(&server_rio, buf, MAX_OBJECT_SIZE)) > 0) {
+			if (size_count == 0) {
+				reqtrace_event(request_id, EV_PROXY_FIRST_BYTE);
+			}
 			size_count += n;
 			memcpy(buf_pointer, buf, n);
 			buf_pointer += n;
 		}
+		reqtrace_event(request_id, EV_PROXY_ORIGIN_DONE);
 
 		/* find the url in cache again to make sure (for unique tests) */
 		pthread_mutex_lock(&mutex);
@@ -229,6 +252,7 @@ void doit(int connfd) {
 		/* close server file descriptor */
 		Close(serverfd);
 	}
+	reqtrace_event(request_id, EV_PROXY_DONE);
 
 }
 
@@ -308,10 +332,12 @@ void parse_uri(char *uri, char *hostname, char *path, char *port) {
  * char *port - the string of port
  * rio_t *client_rio - the rio struct of client
  * char *http_header - the string of http header to be writen
+ * uint64_t request_id - trace id to forward to the server, 0 for none
  * return: none
  */
-void build_http_header(char *hostname, char *path, 
-	                   char *port, rio_t *client_rio, char *http_header) {
+void build_http_header(char *hostname, char *path, char *port,
+	                   rio_t *client_rio, char *http_header,
+	                   uint64_t request_id) {
 	char buf[MAXLINE];
 	char request_header[MAXLINE], host_header[MAXLINE], other_header[MAXLINE];
 	int n;
@@ -321,6 +347,10 @@ void build_http_header(char *hostname, char *path,
 	while ((n = Rio_readlineb(client_rio, buf, MAXLINE)) > 0) {
 		if (!strncasecmp(buf, host_key, strlen(host_key))) { //Host
 			strcpy(host_header, buf);
+		} else if (request_id != 0
+		           && !strncasecmp(buf, request_id_key,
+		                           strlen(request_id_key))) {
+			continue; // replaced by our own id below
 		} else if (strncasecmp(buf,connection_key,strlen(connection_key))
              && strncasecmp(buf,proxy_connection_key,strlen(proxy_connection_key))
              && strncasecmp(buf,user_agent_key,strlen(user_agent_key))) {
@@ -341,6 +371,10 @@ void build_http_header(char *hostname, char *path,
 	strcat(http_header, connection_header);
 	strcat(http_header, proxy_connection_header);
 	strcat(http_header, header_user_agent);
+	if (request_id != 0) {
+		sprintf(buf, "%s: %016" PRIx64 "\r\n", request_id_key, request_id);
+		strcat(http_header, buf);
+	}
 	strcat(http_header, end_header);
 	return;
 }
@@ -0,0 +1,183 @@
+/*
+ * @file reqtrace.c
+ * Lock-free per-thread event rings in POSIX shared memory.
+ * See reqtrace.h for the overall design.
+ */
+
+#include "reqtrace.h"
+#include <stdio.h>                      /* fprintf() */
+#include <stdlib.h>                     /* getenv() */
+#include <time.h>                       /* clock_gettime() */
+#include <fcntl.h>                      /* O_CREAT */
+#include <unistd.h>                     /* ftruncate() */
+#include <sys/mman.h>                   /* shm_open(), mmap() */
+#include <pthread.h>                    /* pthread_key_t */
+
+/* the segment of this process, NULL when tracing is off */
+static reqtrace_shm *shm = NULL;
+
+/* request ids handed out by this process */
+static uint32_t next_id = 0;
+
+/* ring claimed by the calling thread, NULL until its first event */
+static __thread reqtrace_ring *my_ring = NULL;
+static __thread uint32_t my_ring_index = 0;
+
+/* hands the ring back when its thread exits */
+static pthread_key_t ring_key;
+
+/*
+ * ring_release - pthread key destructor; frees the ring for another thread.
+ * The release store orders this thread's records before the next owner's.
+ * args: void *ring - the reqtrace_ring owned by the exiting thread
+ * return: none
+ */
+static void ring_release(void *ring) {
+	__atomic_store_n(&((reqtrace_ring *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * ring_claim - find an unowned ring for the calling thread
+ * args: none
+ * return: true if my_ring is now set
+ */
+static int ring_claim(void) {
+	uint32_t i;
+
+	for (i = 0; i < REQTRACE_RINGS; i++) {
+		uint32_t expected = 0;
+		if (__atomic_compare_exchange_n(&shm->rings[i].owned, &expected, 1,
+		                                0, __ATOMIC_ACQUIRE,
+		                                __ATOMIC_RELAXED)) {
+			my_ring = &shm->rings[i];
+			my_ring_index = i;
+			pthread_setspecific(ring_key, my_ring);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * reqtrace_init - map "/reqtrace-<role>" if REQTRACE_ENV is set.
+ * A previous segment of the same name is truncated, so every run
+ * starts with empty rings.
+ * args: const char *role - "proxy" or "tiny"
+ * return: none
+ */
+void reqtrace_init(const char *role) {
+	char name[64];
+	int fd;
+	void *p;
+
+	if (getenv(REQTRACE_ENV) == NULL) {
+		return;
+	}
+
+	snprintf(name, sizeof(name), "/reqtrace-%s", role);
+	fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror("reqtrace: shm_open");
+		return;
+	}
+	if (ftruncate(fd, sizeof(reqtrace_shm)) < 0) {
+		perror("reqtrace: ftruncate");
+		close(fd);
+		return;
+	}
+	p = mmap(NULL, sizeof(reqtrace_shm), PROT_READ | PROT_WRITE,
+	         MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror("reqtrace: mmap");
+		return;
+	}
+
+	if (pthread_key_create(&ring_key, ring_release) != 0) {
+		munmap(p, sizeof(reqtrace_shm));
+		return;
+	}
+
+	/* the fresh segment is zero filled; only the header needs setting */
+	shm = p;
+	shm->pid = getpid();
+	__atomic_store_n(&shm->magic, REQTRACE_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * reqtrace_enabled - whether events are being recorded
+ * args: none
+ * return: non-zero if tracing is on
+ */
+int reqtrace_enabled(void) {
+	return shm != NULL;
+}
+
+/*
+ * reqtrace_new_id - a request id unique across the processes of one host
+ * args: none
+ * return: (pid << 32) | per-process sequence number, never 0
+ */
+uint64_t reqtrace_new_id(void) {
+	uint32_t seq = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+	return ((uint64_t)getpid() << 32) | seq;
+}
+
+/*
+ * reqtrace_now - current CLOCK_MONOTONIC time
+ * args: none
+ * return: nanoseconds
+ */
+uint64_t reqtrace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * reqtrace_event_at - record an event with a given timestamp.
+ * Useful when the request id is only known after the event happened,
+ * e.g. Tiny reads the id from a header after the request line.
+ * args:
+ * uint64_t id - request id (events with id 0 are ignored)
+ * reqtrace_type event - what happened
+ * uint64_t ns - when it happened (reqtrace_now())
+ * return: none
+ */
+void reqtrace_event_at(uint64_t id, reqtrace_type event, uint64_t ns) {
+	reqtrace_record *rec;
+	uint64_t head;
+
+	if (shm == NULL || id == 0) {
+		return;
+	}
+
+	/* sharing a ring would break the single-writer rule, so drop instead */
+	if (my_ring == NULL && !ring_claim()) {
+		__atomic_fetch_add(&shm->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/* only the owner writes head, so a plain load is enough */
+	head = my_ring->head;
+	rec = &my_ring->records[head & (REQTRACE_RING_SIZE - 1)];
+	rec->id = id;
+	rec->ns = ns;
+	rec->event = event;
+	rec->ring = my_ring_index;
+	__atomic_store_n(&my_ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * reqtrace_event - record an event that happens now
+ * args:
+ * uint64_t id - request id
+ * reqtrace_type event - what happened
+ * return: none
+ */
+void reqtrace_event(uint64_t id, reqtrace_type event) {
+	if (shm == NULL || id == 0) {
+		return;
+	}
+	reqtrace_event_at(id, event, reqtrace_now());
+}
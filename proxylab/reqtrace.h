@@ -0,0 +1,75 @@
+/*
+ * @file reqtrace.h
+ * Per-request event tracing shared by the proxy and Tiny.
+ *
+ * Each process that calls reqtrace_init() with REQTRACE_ENV set in its
+ * environment maps a POSIX shared memory segment named "/reqtrace-<role>".
+ * Every thread claims a ring in that segment the first time it records an
+ * event and hands it back when it exits, so a ring only ever has one
+ * writer and writers never contend with each other: a record is
+ * stored into the slot and then published by advancing the ring head with
+ * a release store. Readers (tracestat) map the segment read-only and use
+ * the head to tell which slots are still intact.
+ *
+ * The proxy assigns a request id in doit() and forwards it to the origin
+ * in a REQTRACE_HEADER header, so events from both sides can be joined.
+ */
+
+#ifndef __REQTRACE_H__
+#define __REQTRACE_H__
+
+#include <stdint.h>
+
+#define REQTRACE_ENV "REQTRACE"              /* enables tracing when set */
+#define REQTRACE_HEADER "X-Request-Id"       /* carries the id to the origin */
+#define REQTRACE_MAGIC 0x52515452u           /* "RQTR" */
+#define REQTRACE_RINGS 64                    /* rings (threads) per process */
+#define REQTRACE_RING_SIZE 4096              /* records per ring, power of 2 */
+
+/* events, in the order they happen for one request */
+typedef enum {
+	EV_PROXY_ACCEPT = 1,  // proxy: request line read from the client
+	EV_PROXY_CACHE_HIT,   // proxy: served from the cache
+	EV_PROXY_CONNECT,     // proxy: connected to the origin
+	EV_PROXY_SENT,        // proxy: request forwarded to the origin
+	EV_PROXY_FIRST_BYTE,  // proxy: first response bytes from the origin
+	EV_PROXY_ORIGIN_DONE, // proxy: origin closed the connection
+	EV_PROXY_DONE,        // proxy: response written to the client
+	EV_TINY_START,        // tiny: request line read
+	EV_TINY_DONE,         // tiny: response written
+	EV_MAX
+} reqtrace_type;
+
+/* one timestamped event */
+typedef struct {
+	uint64_t id;    // request id
+	uint64_t ns;    // CLOCK_MONOTONIC timestamp in nanoseconds
+	uint32_t event; // reqtrace_type
+	uint32_t ring;  // ring (thread) that recorded it
+} reqtrace_record;
+
+/* single-writer ring; head counts every record ever written */
+typedef struct {
+	uint64_t head;
+	uint32_t owned; // set while a thread is writing to this ring
+	uint32_t pad;
+	reqtrace_record records[REQTRACE_RING_SIZE];
+} reqtrace_ring;
+
+/* layout of the shared memory segment */
+typedef struct {
+	uint32_t magic;
+	int32_t pid;
+	uint32_t dropped; // events lost because every ring was taken
+	uint32_t pad;
+	reqtrace_ring rings[REQTRACE_RINGS];
+} reqtrace_shm;
+
+void reqtrace_init(const char *role);
+int reqtrace_enabled(void);
+uint64_t reqtrace_new_id(void);
+uint64_t reqtrace_now(void);
+void reqtrace_event_at(uint64_t id, reqtrace_type event, uint64_t ns);
+void reqtrace_event(uint64_t id, reqtrace_type event);
+
+#endif /* __REQTRACE_H__ */
@@ -1,41 +1,91 @@
 /*
  * adder.c - a minimal CGI program that adds two numbers together
+ *
+ * Run normally, it reads QUERY_STRING and writes one response. Started by
+ * Tiny as a persistent worker (FCGI_ENV set), it instead answers request
+ * frames from standard input until Tiny closes the socket.
  */
 /* $begin adder */
 #include "csapp.h"
+#include "../fcgi.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-int main(void) {
-    char *buf, *p;
+/*
+ * make_response - format the CGI output (headers and body) for one query
+ *
+ * query - The QUERY_STRING, or NULL. Modified while parsing.
+ * buf - The buffer for the output; must hold MAXLINE bytes.
+ *
+ * Returns the length of the output.
+ */
+static size_t make_response(char *query, char *buf) {
+    char *p;
     char content[MAXLINE];
     int n1=0, n2=0;
 
     /* Extract the two arguments */
-    if ((buf = getenv("QUERY_STRING")) != NULL) {
-        p = strchr(buf, '&');
+    if (query != NULL) {
+        p = strchr(query, '&');
         if (p != NULL) {
             *p = '\0';
-            n1 = atoi(buf);
+            n1 = atoi(query);
             n2 = atoi(p+1);
         }
     }
 
     /* Make the response body */
-    sprintf(content, "Welcome to add.com: ");
-    sprintf(content, "%sTHE Internet addition portal.\r\n<p>", content);
-    sprintf(content, "%sThe answer is: %d + %d = %d\r\n<p>",
-            content, n1, n2, n1 + n2);
-    sprintf(content, "%sThanks for visiting!\r\n", content);
+    snprintf(content, MAXLINE,
+            "Welcome to add.com: THE Internet addition portal.\r\n<p>" \
+            "The answer is: %d + %d = %d\r\n<p>" \
+            "Thanks for visiting!\r\n",
+            n1, n2, n1 + n2);
 
     /* Generate the HTTP response */
-    printf("Connection: close\r\n");
-    printf("Content-length: %d\r\n", (int)strlen(content));
-    printf("Content-type: text/html\r\n");
-    printf("\r\n");
-    printf("%s", content);
+    return snprintf(buf, MAXLINE,
+            "Connection: close\r\n" \
+            "Content-length: %d\r\n" \
+            "Content-type: text/html\r\n" \
+            "\r\n" \
+            "%s",
+            (int)strlen(content), content);
+}
+
+/*
+ * serve_worker - answer request frames from Tiny until the socket closes
+ */
+static void serve_worker(int fd) {
+    char query[FCGI_MAX_PAYLOAD + 1];
+    char buf[MAXLINE];
+    fcgi_header hdr;
+
+    while (fcgi_read_frame(fd, &hdr, query, FCGI_MAX_PAYLOAD) == 0) {
+        if (hdr.type != FCGI_REQUEST) {
+            continue;
+        }
+        query[hdr.len] = '\0';
+
+        size_t buflen = make_response(query, buf);
+        if (fcgi_write_frame(fd, FCGI_STDOUT, hdr.id, buf, buflen) < 0
+                || fcgi_write_frame(fd, FCGI_END, hdr.id, NULL, 0) < 0) {
+            return;
+        }
+    }
+}
+
+int main(void) {
+    char buf[MAXLINE];
+
+    if (getenv(FCGI_ENV) != NULL) {
+        serve_worker(STDIN_FILENO);
+        exit(0);
+    }
+
+    size_t buflen = make_response(getenv("QUERY_STRING"), buf);
+    fwrite(buf, 1, buflen, stdout);
     fflush(stdout);
 
     exit(0);
@@ -0,0 +1,87 @@
+/*
+ * fcgi.c - framed protocol between Tiny and its persistent CGI workers
+ *
+ * See fcgi.h for the frame format. Both Tiny and the CGI programs link
+ * this file, so it only depends on the C library.
+ */
+
+#include "fcgi.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * read_full - read exactly n bytes, restarting after short reads.
+ * Returns 0 on success, or -1 on error or end of file.
+ */
+static int read_full(int fd, void *buf, size_t n) {
+    char *p = buf;
+
+    while (n > 0) {
+        ssize_t rc = read(fd, p, n);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            return -1;
+        }
+        p += rc;
+        n -= rc;
+    }
+
+    return 0;
+}
+
+int fcgi_write_frame(int fd, fcgi_type type, uint32_t id,
+        const void *buf, size_t len) {
+    if (len > FCGI_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    fcgi_header hdr = { type, id, (uint32_t) len };
+    struct iovec iov[2] = {
+        { &hdr, sizeof(hdr) },
+        { (void *) buf, len },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    /* Header and payload go out together; a dead peer must not SIGPIPE us */
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        while (msg.msg_iovlen > 0 && (size_t) n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+int fcgi_read_frame(int fd, fcgi_header *hdr, void *buf, size_t buflen) {
+    if (read_full(fd, hdr, sizeof(*hdr)) < 0) {
+        return -1;
+    }
+    if (hdr->len > buflen) {
+        return -1; // Framing is lost; the caller must drop the connection
+    }
+    return read_full(fd, buf, hdr->len);
+}
@@ -0,0 +1,58 @@
+/*
+ * fcgi.h - framed protocol between Tiny and its persistent CGI workers
+ *
+ * In worker mode Tiny keeps a pool of long-lived processes for each CGI
+ * program instead of forking one per request. A worker is started with
+ * FCGI_ENV set in its environment and a Unix domain socket on standard
+ * input (as in FastCGI). Every message on the socket is a frame: a fixed
+ * header followed by len payload bytes.
+ *
+ *   FCGI_REQUEST   Tiny -> worker   payload is the QUERY_STRING
+ *   FCGI_STDOUT    worker -> Tiny   payload is a chunk of CGI output
+ *   FCGI_END       worker -> Tiny   no payload; the response is complete
+ *
+ * Tiny serves one connection at a time, so a worker has at most one
+ * request in flight. Every frame still carries the id of the request it
+ * belongs to, so that output of a request Tiny has already given up on
+ * can be recognized and dropped.
+ */
+#ifndef __FCGI_H__
+#define __FCGI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Set in a worker's environment; the socket is its standard input */
+#define FCGI_ENV "TINY_FCGI"
+
+/* Largest payload carried by a single frame */
+#define FCGI_MAX_PAYLOAD 8192
+
+typedef enum {
+    FCGI_REQUEST = 1,
+    FCGI_STDOUT = 2,
+    FCGI_END = 3
+} fcgi_type;
+
+/* Frame header, sent in host byte order (both ends are on one machine) */
+typedef struct {
+    uint32_t type;      // One of fcgi_type
+    uint32_t id;        // Request the frame belongs to
+    uint32_t len;       // Number of payload bytes that follow
+} fcgi_header;
+
+/*
+ * fcgi_write_frame - send one frame; len must not exceed FCGI_MAX_PAYLOAD.
+ * Returns 0 on success, or -1 on error.
+ */
+int fcgi_write_frame(int fd, fcgi_type type, uint32_t id,
+        const void *buf, size_t len);
+
+/*
+ * fcgi_read_frame - receive one frame into hdr and buf, which must hold
+ * buflen bytes. Returns 0 on success, or -1 on error, end of file, or
+ * a payload larger than buflen.
+ */
+int fcgi_read_frame(int fd, fcgi_header *hdr, void *buf, size_t buflen);
+
+#endif /* __FCGI_H__ */
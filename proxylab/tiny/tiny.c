@@ -7,24 +7,43 @@
  */
 
 #include "csapp.h"
+#include "fcgi.h"
+#include "reqtrace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <netdb.h>
 
 #define HOSTLEN 256
 #define SERVLEN 8
 
+/* Number of static files whose descriptors are kept open between requests */
+#define FCACHE_ENTRIES 16
+
+/* Files up to this size are kept in memory with their response headers */
+#define HOT_ASSET_MAX (64 * 1024)
+
+/* Limits for the persistent CGI worker pools */
+#define MAX_CGI_POOLS 8
+#define MAX_CGI_WORKERS 16
+
 /* Typedef for convenience */
 typedef struct sockaddr SA;
 
@@ -37,6 +56,57 @@ typedef struct {
     char serv[SERVLEN];         // Client service (port)
 } client_info;
 
+/*
+ * A cached static file. The response headers are assembled once when the
+ * entry is filled. Small "hot" files are read into memory in full so a
+ * response is a single writev(); larger ones keep an open descriptor for
+ * sendfile(). The stat fields are compared against a fresh stat() of the
+ * file on every lookup, so a file that is modified or replaced is reloaded.
+ */
+typedef struct {
+    bool valid;                 // Entry holds a cached file
+    bool gzip;                  // Entry holds the precompressed .gz sibling
+    char filename[MAXLINE];     // File name as produced by parse_uri
+    int fd;                     // Open read-only descriptor, or -1 if hot
+    char *body;                 // File contents if hot, or NULL
+    off_t size;                 // File size when the entry was filled
+    dev_t dev;                  // Device and inode, to detect replacement
+    ino_t ino;
+    struct timespec mtime;      // Modification time when filled
+    char header[MAXBUF];        // Preassembled response headers
+    size_t header_len;
+    unsigned long last_used;    // LRU stamp
+} fcache_entry;
+
+/* The open-file cache and its LRU clock */
+static fcache_entry fcache[FCACHE_ENTRIES];
+static unsigned long fcache_clock;
+
+/* One long-lived CGI process and Tiny's end of its socket */
+typedef struct {
+    pid_t pid;
+    int fd;                     // -1 if the worker is not running
+} cgi_worker;
+
+/*
+ * The workers serving one CGI program. A program that exits without
+ * answering its first request does not speak the worker protocol; it is
+ * marked unsupported and run with fork/exec from then on.
+ */
+typedef struct {
+    bool valid;
+    bool answered;              // Some worker has completed a request
+    bool unsupported;
+    char filename[MAXLINE];
+    cgi_worker workers[MAX_CGI_WORKERS];
+    unsigned next;              // Round-robin dispatch position
+} cgi_pool;
+
+/* Workers per CGI program; 0 means fork and exec for every request */
+static int cgi_workers = 0;
+static cgi_pool cgi_pools[MAX_CGI_POOLS];
+static uint32_t cgi_request_id;
+
 /* URI parsing results. */
 typedef enum {
     PARSE_ERROR,
@@ -44,19 +114,65 @@ typedef enum {
     PARSE_DYNAMIC
 } parse_result;
 
+/*
+ * accepts_gzip - check whether an Accept-Encoding header value lists gzip
+ * with a nonzero quality.
+ *
+ * value - The header value. Must be a NUL-terminated string; it is
+ * modified by tokenizing.
+ */
+static bool accepts_gzip(char *value) {
+    char *saveptr;
+
+    for (char *tok = strtok_r(value, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        tok += strspn(tok, " \t");
+        /* The whole token must be gzip, not just start with it; the
+         * value still ends with the line's CRLF */
+        char *params = tok + strlen("gzip");
+        if (strncasecmp(tok, "gzip", strlen("gzip"))
+                || (*params != '\0' && !strchr("; \t\r\n", *params))) {
+            continue;
+        }
+
+        /* Honour an explicit "gzip;q=0" refusal */
+        char *q = strchr(params, '=');
+        if (strchr(params, ';') && q && strtod(q + 1, NULL) <= 0.0) {
+            return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
 /*
  * read_requesthdrs - read HTTP request headers
+ *
+ * accept_gzip - Set to true if the client accepts gzip content encoding.
+ * request_id - Set to the trace id forwarded by the proxy, or 0 if none.
+ *
  * Returns true if an error occurred, or false otherwise.
  */
-bool read_requesthdrs(rio_t *rp) {
+bool read_requesthdrs(rio_t *rp, bool *accept_gzip, uint64_t *request_id) {
+    static const char encoding_key[] = "Accept-Encoding:";
+    static const char request_id_key[] = REQTRACE_HEADER ":";
     char buf[MAXLINE];
 
+    *accept_gzip = false;
+    *request_id = 0;
     do {
         if (rio_readlineb(rp, buf, MAXLINE) <= 0) {
             return true;
         }
 
         printf("%s", buf);
+
+        if (!strncasecmp(buf, encoding_key, strlen(encoding_key))) {
+            *accept_gzip = accepts_gzip(buf + strlen(encoding_key));
+        } else if (!strncasecmp(buf, request_id_key, strlen(request_id_key))) {
+            *request_id = strtoull(buf + strlen(request_id_key), NULL, 16);
+        }
     } while(strncmp(buf, "\r\n", sizeof("\r\n")));
 
     return false;
@@ -136,62 +252,434 @@ void get_filetype(char *filename, char *filetype) {
 
 
 /*
- * serve_static - copy a file back to the client
+ * fcache_matches - check whether a cache entry still describes the file
+ * on disk, according to a stat() taken for this request.
  */
-void serve_static(int fd, char *filename, int filesize) {
-    int srcfd;
-    char *srcp;
-    char filetype[MAXLINE];
-    char buf[MAXBUF];
-    size_t buflen;
+static bool fcache_matches(fcache_entry *entry, struct stat *sbuf) {
+    return entry->size == sbuf->st_size
+        && entry->dev == sbuf->st_dev
+        && entry->ino == sbuf->st_ino
+        && entry->mtime.tv_sec == sbuf->st_mtim.tv_sec
+        && entry->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
 
-    get_filetype(filename, filetype);
+/*
+ * fcache_evict - release the file held by a cache entry
+ */
+static void fcache_evict(fcache_entry *entry) {
+    if (entry->valid) {
+        if (entry->fd >= 0) {
+            close(entry->fd);
+        }
+        free(entry->body);
+        entry->body = NULL;
+        entry->valid = false;
+    }
+}
 
-    /* Send response headers to client */
-    buflen = snprintf(buf, MAXBUF,
+/*
+ * fcache_load_body - read a whole file into memory for a hot entry.
+ * Returns true if an error occurred, or false otherwise.
+ */
+static bool fcache_load_body(fcache_entry *entry) {
+    /* malloc(0) may return NULL; always ask for at least one byte */
+    char *body = malloc(entry->size > 0 ? entry->size : 1);
+    if (body == NULL) {
+        return true;
+    }
+
+    off_t offset = 0;
+    while (offset < entry->size) {
+        ssize_t n = pread(entry->fd, body + offset,
+                entry->size - offset, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(body);
+            return true;
+        }
+        offset += n;
+    }
+
+    entry->body = body;
+    return false;
+}
+
+/*
+ * fcache_lookup - find the cache entry for a static file, loading (or
+ * reloading) the file if it is not cached or is stale.
+ *
+ * filename - The file name. Must be a NUL-terminated string.
+ * sbuf - The result of stat() on the file that will be served.
+ * gzip - If true, serve the precompressed sibling filename.gz instead.
+ *
+ * Returns the entry, or NULL if the file could not be loaded.
+ */
+static fcache_entry *fcache_lookup(char *filename, struct stat *sbuf,
+        bool gzip) {
+    fcache_entry *victim = &fcache[0];
+
+    for (int i = 0; i < FCACHE_ENTRIES; i++) {
+        fcache_entry *entry = &fcache[i];
+        if (entry->valid && entry->gzip == gzip
+                && !strncmp(entry->filename, filename, MAXLINE)) {
+            if (fcache_matches(entry, sbuf)) {
+                entry->last_used = ++fcache_clock;
+                return entry;
+            }
+            /* The file changed on disk; refill this slot */
+            victim = entry;
+            break;
+        }
+
+        /* Prefer an empty slot, otherwise the least recently used one */
+        if (!entry->valid
+                || (victim->valid && entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+
+    fcache_evict(victim);
+
+    char path[MAXLINE];
+    if (snprintf(path, MAXLINE, "%s%s", filename, gzip ? ".gz" : "")
+            >= MAXLINE) {
+        return NULL; // Overflow!
+    }
+
+    int srcfd = open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (srcfd < 0) {
+        perror(path);
+        return NULL;
+    }
+
+    /* Record what we actually opened, in case it changed since stat() */
+    struct stat fbuf;
+    if (fstat(srcfd, &fbuf) < 0) {
+        perror("fstat");
+        close(srcfd);
+        return NULL;
+    }
+
+    strncpy(victim->filename, filename, MAXLINE - 1);
+    victim->filename[MAXLINE - 1] = '\0';
+    victim->gzip = gzip;
+    victim->fd = srcfd;
+    victim->size = fbuf.st_size;
+    victim->dev = fbuf.st_dev;
+    victim->ino = fbuf.st_ino;
+    victim->mtime = fbuf.st_mtim;
+
+    /* The type comes from the original name, not the .gz sibling */
+    char filetype[MAXLINE];
+    get_filetype(filename, filetype);
+    victim->header_len = snprintf(victim->header, MAXBUF,
             "HTTP/1.0 200 OK\r\n" \
             "Server: Tiny Web Server\r\n" \
             "Connection: close\r\n" \
-            "Content-Length: %d\r\n" \
-            "Content-Type: %s\r\n\r\n", \
-            filesize, filetype);
-    if (buflen >= MAXBUF) {
-        return; // Overflow!
+            "Content-Length: %jd\r\n" \
+            "Content-Type: %s\r\n" \
+            "%s\r\n", \
+            (intmax_t) victim->size, filetype,
+            gzip ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "");
+    if (victim->header_len >= MAXBUF) {
+        close(srcfd);
+        return NULL; // Overflow!
     }
 
-    printf("Response headers:\n%s", buf);
+    /* Hot assets live in memory, so their descriptor is not needed */
+    if (victim->size <= HOT_ASSET_MAX) {
+        bool error = fcache_load_body(victim);
+        close(victim->fd);
+        victim->fd = -1;
+        if (error) {
+            fprintf(stderr, "Error reading static file \"%s\"\n", path);
+            return NULL;
+        }
+    }
 
-    if (rio_writen(fd, buf, buflen) < 0) {
-        fprintf(stderr, "Error writing static response headers to client\n");
-        return;
+    victim->last_used = ++fcache_clock;
+    victim->valid = true;
+
+    return victim;
+}
+
+/*
+ * write_file_mmap - copy a file to the client through an mmap'd buffer.
+ * Used when sendfile() is not supported for the descriptor pair.
+ * Returns true if an error occurred, or false otherwise.
+ */
+static bool write_file_mmap(int fd, int srcfd, off_t offset, off_t size) {
+    char *srcp = mmap(0, size, PROT_READ, MAP_PRIVATE, srcfd, 0);
+    if (srcp == MAP_FAILED) {
+        perror("mmap");
+        return true;
     }
 
+    bool error = rio_writen(fd, srcp + offset, size - offset) < 0;
 
-    /* Send response body to client */
-    srcfd = open(filename, O_RDONLY, 0);
-    if (srcfd < 0) {
-        perror(filename);
+    if (munmap(srcp, size) < 0) {
+        perror("munmap");
+    }
+    return error;
+}
+
+/*
+ * write_file - copy size bytes of an open file to the client, letting the
+ * kernel move the data with sendfile().
+ * Returns true if an error occurred, or false otherwise.
+ */
+static bool write_file(int fd, int srcfd, off_t size) {
+    off_t offset = 0;
+
+    while (offset < size) {
+        ssize_t n = sendfile(fd, srcfd, &offset, size - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                return write_file_mmap(fd, srcfd, offset, size);
+            }
+            return true;
+        }
+        if (n == 0) {
+            return true; // File was truncated underneath us
+        }
+    }
+
+    return false;
+}
+
+/*
+ * writev_all - write every byte described by an iovec array, restarting
+ * after short writes.
+ * Returns true if an error occurred, or false otherwise.
+ */
+static bool writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return true;
+        }
+
+        /* Skip the buffers that were written completely */
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * serve_static - copy a file back to the client
+ *
+ * gzip - If true, send the precompressed sibling filename.gz; sbuf must
+ * then describe that file.
+ */
+void serve_static(int fd, char *filename, struct stat *sbuf, bool gzip) {
+    fcache_entry *entry = fcache_lookup(filename, sbuf, gzip);
+    if (entry == NULL) {
         return;
     }
 
-    srcp = mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-    if (srcp == MAP_FAILED) {
-        perror("mmap");
-        close(srcfd);
+    printf("Response headers:\n%s", entry->header);
+
+    /* Hot asset: headers and body go out with a single system call */
+    if (entry->body != NULL) {
+        struct iovec iov[2] = {
+            { entry->header, entry->header_len },
+            { entry->body, entry->size },
+        };
+        if (writev_all(fd, iov, 2)) {
+            fprintf(stderr, "Error writing static file \"%s\" to client\n",
+                    filename);
+        }
         return;
     }
-    close(srcfd);
 
-    if (rio_writen(fd, srcp, filesize) < 0) {
+    /* Send response headers to client */
+    if (rio_writen(fd, entry->header, entry->header_len) < 0) {
+        fprintf(stderr, "Error writing static response headers to client\n");
+        return;
+    }
+
+    /* Send response body to client */
+    if (write_file(fd, entry->fd, entry->size)) {
         fprintf(stderr, "Error writing static file \"%s\" to client\n",
                 filename);
-        // Fall through to cleanup
+        /* Don't trust the descriptor's state; reopen on the next request */
+        fcache_evict(entry);
     }
+}
 
-    if (munmap(srcp, filesize) < 0) {
-        perror("munmap");
+/*
+ * cgi_worker_stop - shut down a worker and reap it
+ */
+static void cgi_worker_stop(cgi_worker *worker) {
+    if (worker->fd < 0) {
         return;
     }
+    close(worker->fd);
+    kill(worker->pid, SIGTERM);
+    waitpid(worker->pid, NULL, 0);
+    worker->fd = -1;
+}
+
+/*
+ * cgi_worker_start - start a persistent worker running filename, with one
+ * end of a socket pair as its standard input.
+ * Returns true if an error occurred, or false otherwise.
+ */
+static bool cgi_worker_start(cgi_worker *worker, char *filename) {
+    char *argv[] = { filename, NULL };
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return true;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid == 0) { /* Child */
+        setenv(FCGI_ENV, "1", 1);
+        dup2(sv[1], STDIN_FILENO);
+        close(sv[1]);
+
+        /* Replies go over the socket; a program that ignores the worker
+         * protocol must not write to the server's own stdout */
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+
+        if (execve(filename, argv, environ) < 0) {
+            perror(filename);
+            exit(1);
+        }
+    }
+    close(sv[1]);
+    if (pid == -1) {
+        perror("fork");
+        close(sv[0]);
+        return true;
+    }
+
+    worker->pid = pid;
+    worker->fd = sv[0];
+    return false;
+}
+
+/*
+ * cgi_pool_lookup - find the worker pool for a CGI program, preforking
+ * its workers on first use.
+ * Returns the pool, or NULL if the program must be run with fork/exec.
+ */
+static cgi_pool *cgi_pool_lookup(char *filename) {
+    cgi_pool *pool = NULL;
+
+    for (int i = 0; i < MAX_CGI_POOLS; i++) {
+        if (!cgi_pools[i].valid) {
+            if (pool == NULL) {
+                pool = &cgi_pools[i];
+            }
+        } else if (!strncmp(cgi_pools[i].filename, filename, MAXLINE)) {
+            return cgi_pools[i].unsupported ? NULL : &cgi_pools[i];
+        }
+    }
+
+    if (pool == NULL) {
+        return NULL; // Too many programs; fall back to fork/exec
+    }
+
+    strncpy(pool->filename, filename, MAXLINE - 1);
+    pool->filename[MAXLINE - 1] = '\0';
+    pool->answered = false;
+    pool->unsupported = false;
+    pool->next = 0;
+    pool->valid = true;
+    for (int i = 0; i < cgi_workers; i++) {
+        pool->workers[i].fd = -1;
+        cgi_worker_start(&pool->workers[i], filename);
+    }
+
+    return pool;
+}
+
+/*
+ * serve_dynamic_pooled - forward a CGI request to a persistent worker and
+ * relay its output to the client.
+ * Returns true if the request was handled, or false if the caller should
+ * run the program with fork/exec instead. Nothing beyond the first part
+ * of the response headers has been written when false is returned.
+ */
+static bool serve_dynamic_pooled(int fd, char *filename, char *cgiargs) {
+    cgi_pool *pool = cgi_pool_lookup(filename);
+    if (pool == NULL) {
+        return false;
+    }
+
+    cgi_worker *worker = &pool->workers[pool->next++ % cgi_workers];
+    if (worker->fd < 0 && cgi_worker_start(worker, filename)) {
+        return false;
+    }
+
+    uint32_t id = ++cgi_request_id;
+    if (fcgi_write_frame(worker->fd, FCGI_REQUEST, id,
+                cgiargs, strnlen(cgiargs, MAXLINE)) < 0) {
+        cgi_worker_stop(worker);
+        return false;
+    }
+
+    char buf[FCGI_MAX_PAYLOAD];
+    fcgi_header hdr;
+    bool wrote = false;
+    while (true) {
+        if (fcgi_read_frame(worker->fd, &hdr, buf, sizeof(buf)) < 0) {
+            /* The worker died; it is restarted on its next turn */
+            cgi_worker_stop(worker);
+            if (!pool->answered) {
+                /* Not a worker program; the others have exited too */
+                pool->unsupported = true;
+                for (int i = 0; i < cgi_workers; i++) {
+                    cgi_worker_stop(&pool->workers[i]);
+                }
+            }
+            return wrote;
+        }
+
+        /* Drop output left over from a request we abandoned */
+        if (hdr.id != id) {
+            continue;
+        }
+
+        if (hdr.type == FCGI_END) {
+            pool->answered = true;
+            return true;
+        }
+
+        if (hdr.type == FCGI_STDOUT) {
+            wrote = true;
+            if (rio_writen(fd, buf, hdr.len) < 0) {
+                fprintf(stderr, "Error writing dynamic response to client\n");
+                /* The worker's remaining frames are dropped by id later */
+                return true;
+            }
+        }
+    }
 }
 
 /*
@@ -216,6 +704,10 @@ void serve_dynamic(int fd, char *filename, char *cgiargs) {
         return;
     }
 
+    if (cgi_workers > 0 && serve_dynamic_pooled(fd, filename, cgiargs)) {
+        return;
+    }
+
     pid_t pid = fork();
     if (pid == 0) { /* Child */
         /* Real server would set all CGI vars here */
@@ -236,8 +728,8 @@ void serve_dynamic(int fd, char *filename, char *cgiargs) {
         return;
     }
 
-    /* Parent waits for and reaps child */
-    if (wait(NULL) < 0) {
+    /* Parent waits for and reaps child (not one of the pooled workers) */
+    if (waitpid(pid, NULL, 0) < 0) {
         perror("wait");
         return;
     }
@@ -317,6 +809,8 @@ void serve(client_info *client) {
     if (rio_readlineb(&rio, buf, MAXLINE) <= 0) {
         return;
     }
+    /* The trace id arrives in a header, so remember when we started */
+    uint64_t start_ns = reqtrace_enabled() ? reqtrace_now() : 0;
 
     printf("%s", buf);
 
@@ -342,9 +836,12 @@ void serve(client_info *client) {
     }
 
     /* Check if reading request headers caused an error */
-    if (read_requesthdrs(&rio)) {
+    bool accept_gzip;
+    uint64_t request_id;
+    if (read_requesthdrs(&rio, &accept_gzip, &request_id)) {
         return;
     }
+    reqtrace_event_at(request_id, EV_TINY_START, start_ns);
 
     /* Parse URI from GET request */
     char filename[MAXLINE], cgiargs[MAXLINE];
@@ -352,6 +849,7 @@ void serve(client_info *client) {
     if (result == PARSE_ERROR) {
         clienterror(client->connfd, uri, "400", "Bad Request",
                 "Tiny could not parse the request URI");
+        reqtrace_event(request_id, EV_TINY_DONE);
         return;
     }
 
@@ -360,6 +858,7 @@ void serve(client_info *client) {
     if (stat(filename, &sbuf) < 0) {
         clienterror(client->connfd, filename, "404", "Not found",
                 "Tiny couldn't find this file");
+        reqtrace_event(request_id, EV_TINY_DONE);
         return;
     }
 
@@ -367,34 +866,63 @@ void serve(client_info *client) {
         if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
             clienterror(client->connfd, filename, "403", "Forbidden",
                     "Tiny couldn't read the file");
+            reqtrace_event(request_id, EV_TINY_DONE);
             return;
         }
-        serve_static(client->connfd, filename, sbuf.st_size);
+
+        /* Prefer a precompressed sibling if the client can decode it,
+         * unless it is older than the file and so may be stale */
+        char gzname[MAXLINE];
+        struct stat gzbuf;
+        bool gzip = accept_gzip
+            && snprintf(gzname, MAXLINE, "%s.gz", filename) < MAXLINE
+            && stat(gzname, &gzbuf) == 0
+            && S_ISREG(gzbuf.st_mode) && (S_IRUSR & gzbuf.st_mode)
+            && gzbuf.st_mtime >= sbuf.st_mtime;
+
+        serve_static(client->connfd, filename, gzip ? &gzbuf : &sbuf, gzip);
     } else { /* Serve dynamic content */
         if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
             clienterror(client->connfd, filename, "403", "Forbidden",
                     "Tiny couldn't run the CGI program");
+            reqtrace_event(request_id, EV_TINY_DONE);
             return;
         }
         serve_dynamic(client->connfd, filename, cgiargs);
     }
+    reqtrace_event(request_id, EV_TINY_DONE);
 }
 
 int main(int argc, char **argv) {
     int listenfd;
 
     /* Check command line args */
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <port> [cgi-workers]\n", argv[0]);
         exit(1);
     }
 
+    /* Optionally keep a pool of persistent workers per CGI program */
+    if (argc == 3) {
+        cgi_workers = atoi(argv[2]);
+        if (cgi_workers < 0 || cgi_workers > MAX_CGI_WORKERS) {
+            fprintf(stderr, "cgi-workers must be between 0 and %d\n",
+                    MAX_CGI_WORKERS);
+            exit(1);
+        }
+    }
+
     listenfd = open_listenfd(argv[1]);
     if (listenfd < 0) {
         fprintf(stderr, "Failed to listen on port: %s\n", argv[1]);
         exit(1);
     }
 
+    reqtrace_init("tiny");
+
+    /* Long-lived CGI workers must not hold on to our sockets */
+    fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+
     while (1) {
         /* Allocate space on the stack for client info */
         client_info client_data;
@@ -410,6 +938,7 @@ int main(int argc, char **argv) {
             perror("accept");
             continue;
         }
+        fcntl(client->connfd, F_SETFD, FD_CLOEXEC);
 
         /* Connection is established; serve client */
         serve(client);
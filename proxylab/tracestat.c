@@ -0,0 +1,283 @@
+/*
+ * @file tracestat.c
+ * Stitch the proxy's and Tiny's trace events into per-request latency
+ * breakdowns.
+ *
+ * Run the proxy and Tiny with REQTRACE set in their environment, drive
+ * some load through the proxy, then run this tool on the same host. It
+ * maps /reqtrace-proxy and /reqtrace-tiny read-only, joins the events by
+ * request id and reports, in microseconds:
+ *
+ *   total    - request line read by the proxy until the response is sent
+ *   connect  - request line read until connected to the origin
+ *   upstream - connected to the origin until it closed the connection
+ *   origin   - time spent inside Tiny
+ *   network  - upstream minus origin (transit and kernel queueing)
+ *   proxy    - total minus upstream (time spent in the proxy itself)
+ *
+ * usage: tracestat [-v] [-r]
+ *   -v  also print one line per request
+ *   -r  remove the shared memory segments afterwards
+ */
+
+#include "reqtrace.h"
+#include <stdio.h>                      /* printf() */
+#include <stdlib.h>                     /* qsort() */
+#include <string.h>                     /* memmove() */
+#include <inttypes.h>                   /* PRIx64 */
+#include <fcntl.h>                      /* O_RDONLY */
+#include <unistd.h>                     /* getopt() */
+#include <sys/mman.h>                   /* shm_open(), mmap() */
+
+/* breakdown columns */
+enum { M_TOTAL, M_CONNECT, M_UPSTREAM, M_ORIGIN, M_NETWORK, M_PROXY, M_MAX };
+
+static const char *metric_names[M_MAX] = {
+	"total", "connect", "upstream", "origin", "network", "proxy"
+};
+
+/* samples of one column, in nanoseconds */
+typedef struct {
+	uint64_t *ns;
+	size_t count;
+} samples;
+
+/* all records read from the segments */
+static reqtrace_record *records = NULL;
+static size_t nrecords = 0;
+
+/*
+ * load_segment - append the intact records of "/reqtrace-<role>".
+ * The writers may still be running, so the ring head is read again after
+ * copying and any slot that may have been overwritten meanwhile is dropped.
+ * args: const char *role - "proxy" or "tiny"
+ * return: 0 on success, -1 if the segment is missing or invalid
+ */
+static int load_segment(const char *role) {
+	char name[64];
+	const reqtrace_shm *shm;
+	int fd, i;
+
+	snprintf(name, sizeof(name), "/reqtrace-%s", role);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "tracestat: no %s segment (was %s set?)\n",
+		        name, REQTRACE_ENV);
+		return -1;
+	}
+	shm = mmap(NULL, sizeof(reqtrace_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("tracestat: mmap");
+		return -1;
+	}
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != REQTRACE_MAGIC) {
+		fprintf(stderr, "tracestat: %s is not a trace segment\n", name);
+		munmap((void *)shm, sizeof(reqtrace_shm));
+		return -1;
+	}
+	if (shm->dropped) {
+		fprintf(stderr, "tracestat: %s dropped %u events (all rings busy)\n",
+		        role, shm->dropped);
+	}
+
+	records = realloc(records, (nrecords + (size_t)REQTRACE_RINGS
+	                            * REQTRACE_RING_SIZE) * sizeof(*records));
+	if (records == NULL) {
+		perror("tracestat: realloc");
+		exit(1);
+	}
+
+	for (i = 0; i < REQTRACE_RINGS; i++) {
+		const reqtrace_ring *ring = &shm->rings[i];
+		uint64_t head, first, pos, oldest;
+		size_t start = nrecords;
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		first = head > REQTRACE_RING_SIZE ? head - REQTRACE_RING_SIZE : 0;
+		for (pos = first; pos < head; pos++) {
+			records[nrecords++] =
+				ring->records[pos & (REQTRACE_RING_SIZE - 1)];
+		}
+
+		/* drop what the writer may have lapped while we were copying */
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		oldest = head > REQTRACE_RING_SIZE ? head - REQTRACE_RING_SIZE : 0;
+		if (oldest > first) {
+			size_t lost = oldest - first;
+			if (lost > nrecords - start) {
+				lost = nrecords - start;
+			}
+			memmove(&records[start], &records[start + lost],
+			        (nrecords - start - lost) * sizeof(*records));
+			nrecords -= lost;
+		}
+	}
+
+	munmap((void *)shm, sizeof(reqtrace_shm));
+	return 0;
+}
+
+/*
+ * record_cmp - order records by request id, then by time
+ */
+static int record_cmp(const void *a, const void *b) {
+	const reqtrace_record *x = a, *y = b;
+	if (x->id != y->id) {
+		return x->id < y->id ? -1 : 1;
+	}
+	if (x->ns != y->ns) {
+		return x->ns < y->ns ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * u64_cmp - ascending order of uint64_t
+ */
+static int u64_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * add_sample - append one value to a column
+ */
+static void add_sample(samples *s, uint64_t ns) {
+	s->ns[s->count++] = ns;
+}
+
+/*
+ * percentile - value at quantile q of a sorted column
+ */
+static double percentile(const samples *s, double q) {
+	size_t i = (size_t)(q * (s->count - 1) + 0.5);
+	return s->ns[i] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	samples cols[M_MAX];
+	size_t i, j, requests = 0, hits = 0, incomplete = 0;
+	int verbose = 0, remove_segments = 0, c, m;
+
+	while ((c = getopt(argc, argv, "vr")) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'r':
+			remove_segments = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-r]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (load_segment("proxy") < 0) {
+		exit(1);
+	}
+	/* without Tiny's events we still have the proxy's view */
+	load_segment("tiny");
+
+	qsort(records, nrecords, sizeof(*records), record_cmp);
+	for (m = 0; m < M_MAX; m++) {
+		cols[m].ns = malloc((nrecords + 1) * sizeof(uint64_t));
+		cols[m].count = 0;
+		if (cols[m].ns == NULL) {
+			perror("tracestat: malloc");
+			exit(1);
+		}
+	}
+
+	if (verbose) {
+		printf("%-16s %10s %10s %10s %10s %10s %10s\n", "request",
+		       metric_names[0], metric_names[1], metric_names[2],
+		       metric_names[3], metric_names[4], metric_names[5]);
+	}
+
+	/* one group of records per request id */
+	for (i = 0; i < nrecords; i = j) {
+		uint64_t t[EV_MAX] = {0};
+		uint64_t v[M_MAX];
+		int have[M_MAX] = {0};
+
+		for (j = i; j < nrecords && records[j].id == records[i].id; j++) {
+			/* keep the first occurrence of each event */
+			if (records[j].event < EV_MAX && t[records[j].event] == 0) {
+				t[records[j].event] = records[j].ns;
+			}
+		}
+		requests++;
+
+		if (!t[EV_PROXY_ACCEPT] || !t[EV_PROXY_DONE]) {
+			incomplete++; // still in flight, failed, or lapped by the ring
+			continue;
+		}
+		v[M_TOTAL] = t[EV_PROXY_DONE] - t[EV_PROXY_ACCEPT];
+		have[M_TOTAL] = 1;
+
+		if (t[EV_PROXY_CACHE_HIT]) {
+			hits++;
+			v[M_PROXY] = v[M_TOTAL];
+			have[M_PROXY] = 1;
+		} else if (t[EV_PROXY_CONNECT] && t[EV_PROXY_ORIGIN_DONE]) {
+			v[M_CONNECT] = t[EV_PROXY_CONNECT] - t[EV_PROXY_ACCEPT];
+			v[M_UPSTREAM] = t[EV_PROXY_ORIGIN_DONE] - t[EV_PROXY_CONNECT];
+			v[M_PROXY] = v[M_TOTAL] - v[M_UPSTREAM];
+			have[M_CONNECT] = have[M_UPSTREAM] = have[M_PROXY] = 1;
+			if (t[EV_TINY_START] && t[EV_TINY_DONE]) {
+				v[M_ORIGIN] = t[EV_TINY_DONE] - t[EV_TINY_START];
+				have[M_ORIGIN] = 1;
+				if (v[M_UPSTREAM] >= v[M_ORIGIN]) {
+					v[M_NETWORK] = v[M_UPSTREAM] - v[M_ORIGIN];
+					have[M_NETWORK] = 1;
+				}
+			}
+		}
+
+		if (verbose) {
+			printf("%016" PRIx64, records[i].id);
+		}
+		for (m = 0; m < M_MAX; m++) {
+			if (have[m]) {
+				add_sample(&cols[m], v[m]);
+				if (verbose) {
+					printf(" %10.1f", v[m] / 1000.0);
+				}
+			} else if (verbose) {
+				printf(" %10s", "-");
+			}
+		}
+		if (verbose) {
+			printf("%s\n", t[EV_PROXY_CACHE_HIT] ? " (cache hit)" : "");
+		}
+	}
+
+	printf("%zu requests, %zu complete, %zu cache hits, %zu incomplete\n",
+	       requests, requests - incomplete, hits, incomplete);
+	printf("%-10s %8s %10s %10s %10s %10s %10s   (usec)\n",
+	       "", "count", "mean", "p50", "p90", "p99", "max");
+	for (m = 0; m < M_MAX; m++) {
+		samples *s = &cols[m];
+		double sum = 0;
+		if (s->count == 0) {
+			printf("%-10s %8d\n", metric_names[m], 0);
+			continue;
+		}
+		qsort(s->ns, s->count, sizeof(uint64_t), u64_cmp);
+		for (i = 0; i < s->count; i++) {
+			sum += s->ns[i];
+		}
+		printf("%-10s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       metric_names[m], s->count, sum / s->count / 1000.0,
+		       percentile(s, 0.50), percentile(s, 0.90),
+		       percentile(s, 0.99), s->ns[s->count - 1] / 1000.0);
+	}
+
+	if (remove_segments) {
+		shm_unlink("/reqtrace-proxy");
+		shm_unlink("/reqtrace-tiny");
+	}
+	return 0;
+}